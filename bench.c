@@ -0,0 +1,374 @@
+#include "virtual_alloc.h"
+#include "virtual_region.h"
+#include "virtual_pool.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+Microbenchmark suite for the buddy allocator.
+
+usage: bench [-i initial_size] [-m min_size] [-n iterations]
+             [-w warmup] [-r repetitions] [-l] [-p lowest|lifo]
+             [name_filter]
+
+Every benchmark runs warmup untimed passes and then repetitions timed
+passes, each on a freshly initialised heap. For each benchmark it prints
+the mean, minimum and standard deviation of the time per operation over
+the timed passes, the mean throughput, and how many operations failed
+(malloc or realloc returning NULL, or free returning 1). With -l the
+heaps are initialised with VIRTUAL_LAZY, and with -p lifo with
+VIRTUAL_LIFO.
+*/
+
+#define BATCH 16
+#define CHURN_SLOTS 64
+
+struct bench_config {
+    uint8_t initial_size;
+    uint8_t min_size;
+    uint32_t iterations;
+};
+
+// one benchmark pass. It returns the number of operations performed,
+// and adds the failed ones to failed.
+typedef uint64_t (*bench_fn) (void * heapstart, struct bench_config * cfg,
+			      uint32_t arg, uint64_t * failed);
+
+struct bench_case {
+    char name [48];
+    bench_fn fn;
+    uint32_t arg;
+};
+
+static uint64_t rng_state = 1;
+
+static uint32_t rng_next (void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t) rng_state;
+}
+
+/* malloc and immediately free one block of 2^arg bytes. */
+static uint64_t bench_fixed (void * heapstart, struct bench_config * cfg,
+			     uint32_t arg, uint64_t * failed) {
+    uint32_t i = 0;
+    for (i = 0; i < cfg->iterations; i ++) {
+    	void *ptr = virtual_malloc (heapstart, 1u << arg);
+    	if (ptr == NULL) {
+    		*failed += 1;
+    		continue;
+    	}
+    	*failed += virtual_free (heapstart, ptr);
+    }
+    return 2 * (uint64_t) cfg->iterations;
+}
+
+/*
+malloc BATCH blocks of 2^min_size bytes, then free them in reverse (LIFO)
+or allocation (FIFO) order, depending on arg. With arg 2 they are freed
+in reverse order with virtual_free_sized.
+*/
+static uint64_t bench_batch (void * heapstart, struct bench_config * cfg,
+			     uint32_t arg, uint64_t * failed) {
+    void *ptrs [BATCH];
+    uint32_t rounds = cfg->iterations / BATCH;
+    uint32_t i = 0;
+    uint32_t r = 0;
+    for (r = 0; r < rounds; r ++) {
+    	for (i = 0; i < BATCH; i ++) {
+    		ptrs [i] = virtual_malloc (heapstart, 1u << cfg->min_size);
+    		*failed += (ptrs [i] == NULL);
+    	}
+    	for (i = 0; i < BATCH; i ++) {
+    		void *ptr = (arg == 1) ? ptrs [i] : ptrs [BATCH - 1 - i];
+    		if (ptr != NULL && arg == 2) {
+    			*failed += virtual_free_sized (heapstart, ptr,
+    						       1u << cfg->min_size);
+    		} else if (ptr != NULL) {
+    			*failed += virtual_free (heapstart, ptr);
+    		}
+    	}
+    }
+    return 2 * (uint64_t) rounds * BATCH;
+}
+
+/*
+random churn over CHURN_SLOTS live blocks of 1 to 2^arg bytes: every
+iteration picks a slot and frees it if it is live, or fills it otherwise.
+*/
+static uint64_t bench_churn (void * heapstart, struct bench_config * cfg,
+			     uint32_t arg, uint64_t * failed) {
+    void *slots [CHURN_SLOTS];
+    uint32_t i = 0;
+    memset (slots, 0, sizeof (slots));
+    for (i = 0; i < cfg->iterations; i ++) {
+    	uint32_t k = rng_next () % CHURN_SLOTS;
+    	if (slots [k] != NULL) {
+    		*failed += virtual_free (heapstart, slots [k]);
+    		slots [k] = NULL;
+    	} else {
+    		slots [k] = virtual_malloc (heapstart,
+    					    1 + rng_next () % (1u << arg));
+    		*failed += (slots [k] == NULL);
+    	}
+    }
+    return cfg->iterations;
+}
+
+/*
+realloc growth chains: start at 2^min_size bytes and double the block
+with virtual_realloc until it reaches 2^arg bytes, then free it.
+*/
+static uint64_t bench_realloc_chain (void * heapstart,
+				     struct bench_config * cfg, uint32_t arg,
+				     uint64_t * failed) {
+    uint64_t ops = 0;
+    while (ops < cfg->iterations) {
+    	uint32_t size = 1u << cfg->min_size;
+    	void *ptr = virtual_malloc (heapstart, size);
+    	ops += 1;
+    	if (ptr == NULL) {
+    		*failed += 1;
+    		continue;
+    	}
+    	while (size < (1u << arg)) {
+    		size *= 2;
+    		void *next = virtual_realloc (heapstart, ptr, size);
+    		ops += 1;
+    		if (next == NULL) {
+    			*failed += 1;
+    			break;
+    		}
+    		ptr = next;
+    	}
+    	*failed += virtual_free (heapstart, ptr);
+    	ops += 1;
+    }
+    return ops;
+}
+
+/*
+fragmentation stress: fill part of the heap with minimum size blocks,
+free every other one so no two free blocks are buddies, then request
+blocks of 2^arg bytes, which have to search past the holes.
+*/
+static uint64_t bench_fragment (void * heapstart, struct bench_config * cfg,
+				uint32_t arg, uint64_t * failed) {
+    uint32_t count = cfg->iterations / 4;
+    uint64_t ops = 0;
+    uint32_t i = 0;
+    void **ptrs = calloc (count, sizeof (void *));
+    if (ptrs == NULL) {
+    	return 0;
+    }
+    for (i = 0; i < count; i ++) {
+    	ptrs [i] = virtual_malloc (heapstart, 1u << cfg->min_size);
+    	*failed += (ptrs [i] == NULL);
+    	ops += 1;
+    }
+    for (i = 0; i < count; i += 2) {
+    	if (ptrs [i] != NULL) {
+    		*failed += virtual_free (heapstart, ptrs [i]);
+    		ops += 1;
+    	}
+    }
+    for (i = 0; i < count; i ++) {
+    	void *ptr = virtual_malloc (heapstart, 1u << arg);
+    	*failed += (ptr == NULL);
+    	ops += 1;
+    	if (ptr != NULL) {
+    		*failed += virtual_free (heapstart, ptr);
+    		ops += 1;
+    	}
+    }
+    free (ptrs);
+    return ops;
+}
+
+/*
+request style teardown: bump allocate BATCH objects of 2^arg bytes from
+a region, then drop them all with region_reset. Compare with batch_lifo,
+which frees every object on its own.
+*/
+static uint64_t bench_region (void * heapstart, struct bench_config * cfg,
+			      uint32_t arg, uint64_t * failed) {
+    uint32_t rounds = cfg->iterations / BATCH;
+    uint32_t i = 0;
+    uint32_t r = 0;
+    struct region *region = region_create (heapstart, BATCH << arg);
+    if (region == NULL) {
+    	*failed += 1;
+    	return 0;
+    }
+    for (r = 0; r < rounds; r ++) {
+    	for (i = 0; i < BATCH; i ++) {
+    		*failed += (region_alloc (region, 1u << arg) == NULL);
+    	}
+    	region_reset (region);
+    }
+    region_destroy (region);
+    return (uint64_t) rounds * (BATCH + 1);
+}
+
+/*
+get BATCH objects of 2^arg bytes from a pool, then put them back in
+reverse order, the pool version of batch_lifo.
+*/
+static uint64_t bench_pool (void * heapstart, struct bench_config * cfg,
+			    uint32_t arg, uint64_t * failed) {
+    void *ptrs [BATCH];
+    uint32_t rounds = cfg->iterations / BATCH;
+    uint32_t i = 0;
+    uint32_t r = 0;
+    struct pool *pool = pool_create (heapstart, 1u << arg, 8);
+    if (pool == NULL) {
+    	*failed += 1;
+    	return 0;
+    }
+    for (r = 0; r < rounds; r ++) {
+    	for (i = 0; i < BATCH; i ++) {
+    		ptrs [i] = pool_get (pool);
+    		*failed += (ptrs [i] == NULL);
+    	}
+    	for (i = 0; i < BATCH; i ++) {
+    		if (ptrs [BATCH - 1 - i] != NULL) {
+    			*failed += pool_put (pool, ptrs [BATCH - 1 - i]);
+    		}
+    	}
+    }
+    pool_destroy (pool);
+    return 2 * (uint64_t) rounds * BATCH;
+}
+
+static void usage (void) {
+    fprintf (stderr, "usage: bench [-i initial_size] [-m min_size] "
+             "[-n iterations] [-w warmup] [-r repetitions] [-l] "
+             "[-p lowest|lifo] [filter]\n");
+    exit (1);
+}
+
+int main (int argc, char ** argv) {
+    struct bench_config cfg = { 20, 6, 20000 };
+    uint32_t warmup = 1;
+    uint32_t repetitions = 5;
+    const char *filter = NULL;
+    uint32_t flags = 0;
+    int opt = 0;
+
+    while ((opt = getopt (argc, argv, "i:m:n:w:r:lp:")) != -1) {
+    	if (opt == 'i') {
+    		cfg.initial_size = atoi (optarg);
+    	} else if (opt == 'm') {
+    		cfg.min_size = atoi (optarg);
+    	} else if (opt == 'n') {
+    		cfg.iterations = atoi (optarg);
+    	} else if (opt == 'w') {
+    		warmup = atoi (optarg);
+    	} else if (opt == 'r') {
+    		repetitions = atoi (optarg);
+    	} else if (opt == 'l') {
+    		flags |= VIRTUAL_LAZY;
+    	} else if (opt == 'p' && strcmp (optarg, "lifo") == 0) {
+    		flags |= VIRTUAL_LIFO;
+    	} else if (opt == 'p' && strcmp (optarg, "lowest") == 0) {
+    		flags &= ~VIRTUAL_LIFO;
+    	} else {
+    		usage ();
+    	}
+    }
+    if (optind < argc) {
+    	filter = argv [optind];
+    }
+    if (cfg.initial_size < cfg.min_size || cfg.initial_size > 30 ||
+        cfg.initial_size < cfg.min_size + 4 || repetitions == 0) {
+    	usage ();
+    }
+
+    struct bench_case cases [64];
+    uint32_t ncases = 0;
+    uint32_t k = 0;
+    for (k = cfg.min_size; k <= cfg.min_size + 8 && k < cfg.initial_size;
+         k ++) {
+    	snprintf (cases [ncases].name, 48, "fixed/%u", 1u << k);
+    	cases [ncases].fn = bench_fixed;
+    	cases [ncases ++].arg = k;
+    }
+    snprintf (cases [ncases].name, 48, "batch_lifo/%d", BATCH);
+    cases [ncases].fn = bench_batch;
+    cases [ncases ++].arg = 0;
+    snprintf (cases [ncases].name, 48, "batch_fifo/%d", BATCH);
+    cases [ncases].fn = bench_batch;
+    cases [ncases ++].arg = 1;
+    snprintf (cases [ncases].name, 48, "batch_sized/%d", BATCH);
+    cases [ncases].fn = bench_batch;
+    cases [ncases ++].arg = 2;
+    snprintf (cases [ncases].name, 48, "pool/%d", BATCH);
+    cases [ncases].fn = bench_pool;
+    cases [ncases ++].arg = cfg.min_size;
+    snprintf (cases [ncases].name, 48, "region/%d", BATCH);
+    cases [ncases].fn = bench_region;
+    cases [ncases ++].arg = cfg.min_size;
+    snprintf (cases [ncases].name, 48, "churn/1-%u", 1u << (cfg.min_size + 4));
+    cases [ncases].fn = bench_churn;
+    cases [ncases ++].arg = cfg.min_size + 4;
+    snprintf (cases [ncases].name, 48, "realloc_chain/%u",
+              1u << (cfg.initial_size - 2));
+    cases [ncases].fn = bench_realloc_chain;
+    cases [ncases ++].arg = cfg.initial_size - 2;
+    snprintf (cases [ncases].name, 48, "fragment/%u",
+              1u << (cfg.min_size + 1));
+    cases [ncases].fn = bench_fragment;
+    cases [ncases ++].arg = cfg.min_size + 1;
+
+    printf ("heap 2^%u, min block 2^%u, %u iterations, %u warmup, "
+            "%u repetitions\n", cfg.initial_size, cfg.min_size,
+            cfg.iterations, warmup, repetitions);
+    printf ("%-24s %10s %10s %10s %14s %8s\n", "benchmark", "mean ns/op",
+            "min ns/op", "stddev", "ops/s", "failed");
+
+    uint32_t c = 0;
+    for (c = 0; c < ncases; c ++) {
+    	if (filter != NULL && strstr (cases [c].name, filter) == NULL) {
+    		continue;
+    	}
+    	double sum = 0.0;
+    	double sum_sq = 0.0;
+    	double best = 0.0;
+    	uint64_t failed = 0;
+    	uint32_t r = 0;
+    	for (r = 0; r < warmup + repetitions; r ++) {
+    		void *heapstart = bench_heap_create (cfg.initial_size,
+    						     cfg.min_size);
+    		init_allocator_ex (heapstart, cfg.initial_size,
+    				   cfg.min_size, flags);
+    		rng_state = 88172645463325252ull;
+    		uint64_t pass_failed = 0;
+    		uint64_t start = bench_now_ns ();
+    		uint64_t ops = cases [c].fn (heapstart, &cfg, cases [c].arg,
+    					     &pass_failed);
+    		uint64_t elapsed = bench_now_ns () - start;
+    		if (r < warmup || ops == 0) {
+    			continue;
+    		}
+    		double ns = (double) elapsed / ops;
+    		sum += ns;
+    		sum_sq += ns * ns;
+    		if (best == 0.0 || ns < best) {
+    			best = ns;
+    		}
+    		failed += pass_failed;
+    	}
+    	double mean = sum / repetitions;
+    	double var = sum_sq / repetitions - mean * mean;
+    	printf ("%-24s %10.1f %10.1f %10.1f %14.0f %8lu\n", cases [c].name,
+    	        mean, best, var > 0 ? sqrt (var) : 0.0,
+    	        mean > 0 ? 1e9 / mean : 0.0, failed / repetitions);
+    }
+    bench_heap_destroy ();
+    return 0;
+}
@@ -0,0 +1,469 @@
+#include "virtual_alloc.h"
+#include "bench_util.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Comparative benchmark: runs identical workloads through the buddy
+allocator, the system malloc/free, and a textbook buddy allocator with
+per order free lists, and reports their results side by side.
+
+usage: bench_compare [-i initial_size] [-m min_size] [-n operations]
+                     [-s sample_interval]
+
+Each workload is generated up front as a list of (slot, size) operations,
+where size 0 frees the slot, so every allocator sees exactly the same
+sequence. Every run happens in a forked child, so the system malloc
+starts from a fresh arena. For each allocator it prints throughput, failed operations,
+peak footprint (memory taken from the system), peak live bytes requested,
+and internal/external fragmentation sampled every sample_interval ops.
+*/
+
+#define SLOTS 512
+// largest_free of allocators that cannot tell it.
+#define NO_LARGEST_FREE UINT64_MAX
+
+struct op {
+    uint32_t slot;
+    uint32_t size; // 0 frees the slot
+};
+
+struct workload {
+    const char *name;
+    uint32_t min_request;
+    uint32_t max_request;
+    uint32_t live_percent; // target occupancy of the slots
+};
+
+struct alloc_sample {
+    uint64_t footprint;
+    uint64_t allocated; // bytes handed out, including rounding
+    uint64_t largest_free; // NO_LARGEST_FREE if unknown
+    uint64_t free_bytes;
+};
+
+struct allocator {
+    const char *name;
+    void (*init) (uint8_t initial_size, uint8_t min_size);
+    void * (*alloc) (uint32_t size);
+    void (*release) (void * ptr);
+    void (*sample) (struct alloc_sample * out);
+    void (*destroy) (void);
+};
+
+static uint64_t rng_state = 1;
+
+static uint32_t rng_next (void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t) rng_state;
+}
+
+/* ---- buddy allocator under test ---- */
+
+static void *virtual_heap = NULL;
+
+static void virtual_init (uint8_t initial_size, uint8_t min_size) {
+    virtual_heap = bench_heap_create (initial_size, min_size);
+    init_allocator (virtual_heap, initial_size, min_size);
+}
+
+static void * virtual_alloc (uint32_t size) {
+    return virtual_malloc (virtual_heap, size);
+}
+
+static void virtual_release (void * ptr) {
+    virtual_free (virtual_heap, ptr);
+}
+
+static void virtual_sample (struct alloc_sample * out) {
+    struct virtual_stats st;
+    virtual_stats (virtual_heap, &st);
+    out->footprint = bench_heap_peak ();
+    out->allocated = st.allocated_bytes;
+    out->largest_free = st.largest_free;
+    out->free_bytes = st.free_bytes;
+}
+
+static void virtual_destroy (void) {
+    bench_heap_destroy ();
+}
+
+/*
+---- system malloc ----
+The footprint is measured relative to the arena size when the run
+starts, so the benchmark's own allocations are not counted, and the
+allocated bytes are tracked with malloc_usable_size.
+*/
+
+static uint64_t system_baseline = 0;
+static uint64_t system_allocated = 0;
+
+static void system_init (uint8_t initial_size, uint8_t min_size) {
+    malloc_trim (0);
+    struct mallinfo2 mi = mallinfo2 ();
+    system_baseline = mi.arena + mi.hblkhd;
+    system_allocated = 0;
+}
+
+static void * system_alloc (uint32_t size) {
+    void *ptr = malloc (size);
+    if (ptr != NULL) {
+    	system_allocated += malloc_usable_size (ptr);
+    }
+    return ptr;
+}
+
+static void system_release (void * ptr) {
+    system_allocated -= malloc_usable_size (ptr);
+    free (ptr);
+}
+
+static void system_sample (struct alloc_sample * out) {
+    struct mallinfo2 mi = mallinfo2 ();
+    uint64_t footprint = mi.arena + mi.hblkhd;
+    out->footprint = (footprint > system_baseline) ?
+    		     footprint - system_baseline : 0;
+    out->allocated = system_allocated;
+    out->largest_free = NO_LARGEST_FREE; // not exposed by glibc
+    out->free_bytes = mi.fordblks;
+}
+
+static void system_destroy (void) {
+}
+
+/*
+---- textbook buddy allocator ----
+Free blocks are kept on doubly linked per order lists threaded through
+the blocks themselves, and a byte per minimum size block records the
+order of the block starting there (high bit set while it is free).
+Allocation pops the smallest non empty order found with a bitmap, and
+free merges with the buddy found by xor-ing the offset.
+*/
+
+#define REF_FREE 0x80
+
+struct ref_node {
+    struct ref_node *next;
+    struct ref_node *prev;
+};
+
+static struct {
+    uint8_t *base;
+    uint8_t *order; // one byte per minimum size block
+    struct ref_node *lists [64];
+    uint64_t nonempty;
+    uint8_t initial_size;
+    uint8_t min_size;
+    uint64_t allocated;
+    uint64_t free_bytes;
+} ref;
+
+static void ref_push (uint8_t * block, uint32_t k) {
+    struct ref_node *node = (struct ref_node *) block;
+    node->prev = NULL;
+    node->next = ref.lists [k];
+    if (node->next != NULL) {
+    	node->next->prev = node;
+    }
+    ref.lists [k] = node;
+    ref.nonempty |= 1ull << k;
+    ref.order [(block - ref.base) >> ref.min_size] = REF_FREE | k;
+}
+
+static void ref_unlink (uint8_t * block, uint32_t k) {
+    struct ref_node *node = (struct ref_node *) block;
+    if (node->prev != NULL) {
+    	node->prev->next = node->next;
+    } else {
+    	ref.lists [k] = node->next;
+    }
+    if (node->next != NULL) {
+    	node->next->prev = node->prev;
+    }
+    if (ref.lists [k] == NULL) {
+    	ref.nonempty &= ~(1ull << k);
+    }
+}
+
+static void ref_init (uint8_t initial_size, uint8_t min_size) {
+    // free list nodes live inside free blocks, so they need 16 bytes.
+    if (min_size < 4) {
+    	min_size = 4;
+    }
+    memset (&ref, 0, sizeof (ref));
+    ref.initial_size = initial_size;
+    ref.min_size = min_size;
+    ref.base = aligned_alloc (64, (size_t) 1 << initial_size);
+    ref.order = calloc ((size_t) 1 << (initial_size - min_size), 1);
+    if (ref.base == NULL || ref.order == NULL) {
+    	perror ("reference buddy allocation failed\n");
+    	exit (1);
+    }
+    ref_push (ref.base, initial_size);
+    ref.free_bytes = (uint64_t) 1 << initial_size;
+}
+
+static void * ref_alloc (uint32_t size) {
+    uint32_t k = ref.min_size;
+    while (((uint64_t) 1 << k) < size) {
+    	k += 1;
+    }
+    uint64_t candidates = ref.nonempty & ~((1ull << k) - 1);
+    if (size == 0 || k > ref.initial_size || candidates == 0) {
+    	return NULL;
+    }
+    uint32_t j = __builtin_ctzll (candidates);
+    uint8_t *block = (uint8_t *) ref.lists [j];
+    ref_unlink (block, j);
+    while (j > k) {
+    	j -= 1;
+    	ref_push (block + ((size_t) 1 << j), j);
+    }
+    ref.order [(block - ref.base) >> ref.min_size] = k;
+    ref.allocated += (uint64_t) 1 << k;
+    ref.free_bytes -= (uint64_t) 1 << k;
+    return block;
+}
+
+static void ref_release (void * ptr) {
+    uint64_t offset = (uint8_t *) ptr - ref.base;
+    uint32_t k = ref.order [offset >> ref.min_size];
+    ref.allocated -= (uint64_t) 1 << k;
+    ref.free_bytes += (uint64_t) 1 << k;
+    while (k < ref.initial_size) {
+    	uint64_t buddy = offset ^ ((uint64_t) 1 << k);
+    	if (ref.order [buddy >> ref.min_size] != (REF_FREE | k)) {
+    		break;
+    	}
+    	ref_unlink (ref.base + buddy, k);
+    	ref.order [buddy >> ref.min_size] = 0;
+    	offset &= ~((uint64_t) 1 << k);
+    	k += 1;
+    }
+    ref_push (ref.base + offset, k);
+}
+
+static void ref_sample (struct alloc_sample * out) {
+    out->footprint = ((uint64_t) 1 << ref.initial_size) +
+    		     ((uint64_t) 1 << (ref.initial_size - ref.min_size));
+    out->allocated = ref.allocated;
+    out->free_bytes = ref.free_bytes;
+    out->largest_free = ref.nonempty ?
+    		(uint64_t) 1 << (63 - __builtin_clzll (ref.nonempty)) : 0;
+}
+
+static void ref_destroy (void) {
+    free (ref.base);
+    free (ref.order);
+}
+
+/* ---- driver ---- */
+
+static struct op * generate (struct workload * w, uint32_t count) {
+    struct op *ops = malloc (count * sizeof (struct op));
+    uint8_t live [SLOTS];
+    uint32_t nlive = 0;
+    uint32_t i = 0;
+    memset (live, 0, sizeof (live));
+    rng_state = 88172645463325252ull;
+    for (i = 0; i < count; i ++) {
+    	uint32_t slot = rng_next () % SLOTS;
+    	// allocating more often while below the target occupancy.
+    	uint32_t chance = (nlive * 100 / SLOTS < w->live_percent) ? 60 : 40;
+    	int want_alloc = nlive == 0 ||
+    			 (nlive < SLOTS && rng_next () % 100 < chance);
+    	while (live [slot] == want_alloc) {
+    		slot = (slot + 1) % SLOTS;
+    	}
+    	ops [i].slot = slot;
+    	if (want_alloc) {
+    		// log-uniform sizes, so small requests dominate.
+    		uint32_t span = 32 - __builtin_clz (w->max_request /
+    						   w->min_request);
+    		uint32_t size = w->min_request << (rng_next () % span);
+    		size += rng_next () % size;
+    		ops [i].size = (size > w->max_request) ? w->max_request : size;
+    		live [slot] = 1;
+    		nlive += 1;
+    	} else {
+    		ops [i].size = 0;
+    		live [slot] = 0;
+    		nlive -= 1;
+    	}
+    }
+    return ops;
+}
+
+static void run (struct allocator * a, struct workload * w, struct op * ops,
+		 uint32_t count, uint8_t initial_size, uint8_t min_size,
+		 uint32_t sample_interval) {
+    void *ptrs [SLOTS];
+    uint32_t sizes [SLOTS];
+    uint64_t live = 0;
+    uint64_t peak_live = 0;
+    uint64_t failed = 0;
+    uint64_t elapsed = 0;
+    uint64_t peak_footprint = 0;
+    double peak_external = 0.0;
+    double internal_sum = 0.0;
+    uint32_t samples = 0;
+    struct alloc_sample s;
+    uint32_t i = 0;
+
+    memset (ptrs, 0, sizeof (ptrs));
+    a->init (initial_size, min_size);
+    memset (&s, 0, sizeof (s));
+
+    for (i = 0; i < count; i ++) {
+    	uint32_t slot = ops [i].slot;
+    	uint64_t start = bench_now_ns ();
+    	if (ops [i].size != 0) {
+    		ptrs [slot] = a->alloc (ops [i].size);
+    	} else if (ptrs [slot] != NULL) {
+    		a->release (ptrs [slot]);
+    	}
+    	elapsed += bench_now_ns () - start;
+
+    	if (ops [i].size != 0) {
+    		if (ptrs [slot] == NULL) {
+    			failed += 1;
+    		} else {
+    			// touching the block, as a real caller would.
+    			memset (ptrs [slot], 0, ops [i].size < 64 ?
+    				ops [i].size : 64);
+    			sizes [slot] = ops [i].size;
+    			live += ops [i].size;
+    		}
+    	} else if (ptrs [slot] != NULL) {
+    		live -= sizes [slot];
+    		ptrs [slot] = NULL;
+    	}
+    	if (live > peak_live) {
+    		peak_live = live;
+    	}
+
+    	if ((i + 1) % sample_interval == 0) {
+    		a->sample (&s);
+    		if (s.footprint > peak_footprint) {
+    			peak_footprint = s.footprint;
+    		}
+    		if (s.free_bytes > 0 && s.largest_free > 0 &&
+    		    s.largest_free != NO_LARGEST_FREE) {
+    			double ext = 1.0 - (double) s.largest_free /
+    				     s.free_bytes;
+    			if (ext > peak_external) {
+    				peak_external = ext;
+    			}
+    		}
+    		if (s.allocated > 0) {
+    			internal_sum += 1.0 - (double) live / s.allocated;
+    			samples += 1;
+    		}
+    	}
+    }
+    a->sample (&s);
+    if (s.footprint > peak_footprint) {
+    	peak_footprint = s.footprint;
+    }
+    for (i = 0; i < SLOTS; i ++) {
+    	if (ptrs [i] != NULL) {
+    		a->release (ptrs [i]);
+    	}
+    }
+    a->destroy ();
+
+    // n/a rather than 0, which would read as no fragmentation at all.
+    char external [16] = "n/a";
+    if (s.largest_free != NO_LARGEST_FREE) {
+    	snprintf (external, sizeof (external), "%.3f", peak_external);
+    }
+    printf ("%-14s %-12s %12.0f %8lu %12lu %12lu %9.3f %9s\n", w->name,
+            a->name, elapsed ? count * 1e9 / elapsed : 0.0, failed,
+            peak_footprint, peak_live,
+            samples ? internal_sum / samples : 0.0, external);
+}
+
+static void usage (void) {
+    fprintf (stderr, "usage: bench_compare [-i initial_size] [-m min_size] "
+             "[-n operations] [-s sample_interval]\n");
+    exit (1);
+}
+
+int main (int argc, char ** argv) {
+    uint8_t initial_size = 24;
+    uint8_t min_size = 4;
+    uint32_t count = 200000;
+    uint32_t sample_interval = 1000;
+    int opt = 0;
+
+    while ((opt = getopt (argc, argv, "i:m:n:s:")) != -1) {
+    	if (opt == 'i') {
+    		initial_size = atoi (optarg);
+    	} else if (opt == 'm') {
+    		min_size = atoi (optarg);
+    	} else if (opt == 'n') {
+    		count = atoi (optarg);
+    	} else if (opt == 's') {
+    		sample_interval = atoi (optarg);
+    	} else {
+    		usage ();
+    	}
+    }
+    if (initial_size < min_size || initial_size > 30 || min_size > 20 ||
+        sample_interval == 0) {
+    	usage ();
+    }
+
+    struct workload workloads [] = {
+    	{ "small", 8, 256, 50 },
+    	{ "mixed", 16, 16384, 50 },
+    	{ "large", 4096, 262144, 30 },
+    	{ "high_live", 16, 1024, 90 },
+    };
+    struct allocator allocators [] = {
+    	{ "virtual", virtual_init, virtual_alloc, virtual_release,
+    	  virtual_sample, virtual_destroy },
+    	{ "system", system_init, system_alloc, system_release,
+    	  system_sample, system_destroy },
+    	{ "ref_buddy", ref_init, ref_alloc, ref_release, ref_sample,
+    	  ref_destroy },
+    };
+    uint32_t nworkloads = sizeof (workloads) / sizeof (workloads [0]);
+    uint32_t nallocators = sizeof (allocators) / sizeof (allocators [0]);
+    uint32_t w = 0;
+    uint32_t a = 0;
+
+    printf ("heap 2^%u, min block 2^%u, %u operations per workload\n",
+            initial_size, min_size, count);
+    printf ("%-14s %-12s %12s %8s %12s %12s %9s %9s\n", "workload",
+            "allocator", "ops/s", "failed", "footprint", "peak live",
+            "internal", "external");
+    for (w = 0; w < nworkloads; w ++) {
+    	struct op *ops = generate (&workloads [w], count);
+    	if (ops == NULL) {
+    		return 1;
+    	}
+    	for (a = 0; a < nallocators; a ++) {
+    		fflush (stdout);
+    		pid_t pid = fork ();
+    		if (pid == 0) {
+    			run (&allocators [a], &workloads [w], ops, count,
+    			     initial_size, min_size, sample_interval);
+    			fflush (stdout);
+    			_exit (0);
+    		}
+    		if (pid < 0 || waitpid (pid, NULL, 0) < 0) {
+    			perror ("cannot run benchmark child");
+    			return 1;
+    		}
+    	}
+    	free (ops);
+    }
+    return 0;
+}
@@ -0,0 +1,350 @@
+#include "virtual_alloc.h"
+#include "bench_util.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+Multithreaded scaling benchmark: 1 to N threads doing malloc/free churn
+against one heapstart, for three sharing patterns.
+
+usage: bench_threads [-t max_threads] [-n ops_per_thread]
+                     [-i initial_size] [-m min_size] [-c]
+
+  local    - every thread allocates and frees its own blocks.
+  prodcons - threads are paired; producers allocate blocks and hand them
+             through a ring to consumers, which free them, so every free
+             is a cross thread free.
+  shared   - all threads pick random slots of one shared block table and
+             free or refill them, so blocks migrate between threads.
+
+The allocator keeps no locks of its own, so every call goes through one
+heap mutex (heap_lock). This is the baseline any finer grained locking
+of the buddy[] metadata has to beat. The throughput of each pattern is
+printed per thread count as a table and a bar chart, or as CSV with -c.
+*/
+
+#define LOCAL_SLOTS 64
+#define SHARED_SLOTS 1024
+#define RING_SIZE 64
+#define MAX_THREADS 256
+
+struct ring {
+    void *items [RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+struct shared_slot {
+    pthread_mutex_t lock;
+    void *ptr;
+};
+
+struct worker {
+    pthread_t thread;
+    uint32_t id;
+    uint32_t nthreads;
+    uint64_t seed;
+    uint64_t failed;
+    uint64_t start;
+    uint64_t end;
+};
+
+static void *heapstart = NULL;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_barrier;
+static uint32_t ops_per_thread = 100000;
+static uint32_t max_request = 1024;
+static struct ring rings [MAX_THREADS / 2 + 1];
+static struct shared_slot shared [SHARED_SLOTS];
+
+static uint32_t rng_next (uint64_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (uint32_t) *state;
+}
+
+static void * locked_malloc (uint32_t size) {
+    pthread_mutex_lock (&heap_lock);
+    void *ptr = virtual_malloc (heapstart, size);
+    pthread_mutex_unlock (&heap_lock);
+    return ptr;
+}
+
+static int locked_free (void * ptr) {
+    pthread_mutex_lock (&heap_lock);
+    int result = virtual_free (heapstart, ptr);
+    pthread_mutex_unlock (&heap_lock);
+    return result;
+}
+
+/*
+Every thread times itself from the moment all workers are released, as
+the main thread may not run again until they finish when there are fewer
+cores than threads.
+*/
+static void start_timer (struct worker * w) {
+    pthread_barrier_wait (&start_barrier);
+    w->start = bench_now_ns ();
+}
+
+static void * run_local (void * arg) {
+    struct worker *w = arg;
+    void *slots [LOCAL_SLOTS];
+    uint32_t i = 0;
+    memset (slots, 0, sizeof (slots));
+    start_timer (w);
+    for (i = 0; i < ops_per_thread; i ++) {
+    	uint32_t k = rng_next (&w->seed) % LOCAL_SLOTS;
+    	if (slots [k] != NULL) {
+    		w->failed += locked_free (slots [k]);
+    		slots [k] = NULL;
+    	} else {
+    		slots [k] = locked_malloc (1 + rng_next (&w->seed) % max_request);
+    		w->failed += (slots [k] == NULL);
+    	}
+    }
+    for (i = 0; i < LOCAL_SLOTS; i ++) {
+    	if (slots [i] != NULL) {
+    		locked_free (slots [i]);
+    	}
+    }
+    w->end = bench_now_ns ();
+    return NULL;
+}
+
+static void ring_push (struct ring * r, void * ptr) {
+    pthread_mutex_lock (&r->lock);
+    while (r->tail - r->head == RING_SIZE) {
+    	pthread_cond_wait (&r->not_full, &r->lock);
+    }
+    r->items [r->tail % RING_SIZE] = ptr;
+    r->tail += 1;
+    pthread_cond_signal (&r->not_empty);
+    pthread_mutex_unlock (&r->lock);
+}
+
+static void * ring_pop (struct ring * r) {
+    pthread_mutex_lock (&r->lock);
+    while (r->tail == r->head) {
+    	pthread_cond_wait (&r->not_empty, &r->lock);
+    }
+    void *ptr = r->items [r->head % RING_SIZE];
+    r->head += 1;
+    pthread_cond_signal (&r->not_full);
+    pthread_mutex_unlock (&r->lock);
+    return ptr;
+}
+
+/*
+Even threads produce into ring id / 2 and odd threads consume from it.
+A thread without a partner (the last one of an odd count) produces and
+consumes its own ring in turn. Each side performs ops_per_thread / 2
+transfers, so the total operation count matches the other patterns.
+*/
+static void * run_prodcons (void * arg) {
+    struct worker *w = arg;
+    struct ring *r = &rings [w->id / 2];
+    int paired = (w->id ^ 1) < w->nthreads;
+    uint32_t transfers = ops_per_thread / 2;
+    uint32_t i = 0;
+    start_timer (w);
+    for (i = 0; i < transfers; i ++) {
+    	if (!paired || w->id % 2 == 0) {
+    		void *ptr = locked_malloc (1 + rng_next (&w->seed) % max_request);
+    		w->failed += (ptr == NULL);
+    		ring_push (r, ptr);
+    	}
+    	if (!paired || w->id % 2 == 1) {
+    		void *ptr = ring_pop (r);
+    		if (ptr != NULL) {
+    			w->failed += locked_free (ptr);
+    		}
+    	}
+    }
+    w->end = bench_now_ns ();
+    return NULL;
+}
+
+static void * run_shared (void * arg) {
+    struct worker *w = arg;
+    uint32_t i = 0;
+    start_timer (w);
+    for (i = 0; i < ops_per_thread; i ++) {
+    	struct shared_slot *s = &shared [rng_next (&w->seed) % SHARED_SLOTS];
+    	pthread_mutex_lock (&s->lock);
+    	if (s->ptr != NULL) {
+    		w->failed += locked_free (s->ptr);
+    		s->ptr = NULL;
+    	} else {
+    		s->ptr = locked_malloc (1 + rng_next (&w->seed) % max_request);
+    		w->failed += (s->ptr == NULL);
+    	}
+    	pthread_mutex_unlock (&s->lock);
+    }
+    w->end = bench_now_ns ();
+    return NULL;
+}
+
+struct pattern {
+    const char *name;
+    void * (*fn) (void *);
+};
+
+/*
+This function runs one pattern with the given number of threads on a
+fresh heap, and returns its throughput in operations per second.
+*/
+static double run (struct pattern * p, uint32_t nthreads, uint8_t initial_size,
+		   uint8_t min_size, uint64_t * failed) {
+    struct worker workers [MAX_THREADS];
+    uint32_t i = 0;
+
+    heapstart = bench_heap_create (initial_size, min_size);
+    init_allocator (heapstart, initial_size, min_size);
+    for (i = 0; i < MAX_THREADS / 2 + 1; i ++) {
+    	rings [i].head = 0;
+    	rings [i].tail = 0;
+    }
+    for (i = 0; i < SHARED_SLOTS; i ++) {
+    	shared [i].ptr = NULL;
+    }
+    pthread_barrier_init (&start_barrier, NULL, nthreads);
+
+    for (i = 0; i < nthreads; i ++) {
+    	workers [i].id = i;
+    	workers [i].nthreads = nthreads;
+    	workers [i].seed = 88172645463325252ull + i * 7919;
+    	workers [i].failed = 0;
+    	if (pthread_create (&workers [i].thread, NULL, p->fn,
+    			    &workers [i]) != 0) {
+    		perror ("cannot create benchmark thread");
+    		exit (1);
+    	}
+    }
+    uint64_t start = UINT64_MAX;
+    uint64_t end = 0;
+    *failed = 0;
+    for (i = 0; i < nthreads; i ++) {
+    	pthread_join (workers [i].thread, NULL);
+    	*failed += workers [i].failed;
+    	if (workers [i].start < start) {
+    		start = workers [i].start;
+    	}
+    	if (workers [i].end > end) {
+    		end = workers [i].end;
+    	}
+    }
+    uint64_t elapsed = end - start;
+    pthread_barrier_destroy (&start_barrier);
+    bench_heap_destroy ();
+
+    return elapsed ? (double) nthreads * ops_per_thread * 1e9 / elapsed : 0.0;
+}
+
+static void usage (void) {
+    fprintf (stderr, "usage: bench_threads [-t max_threads] "
+             "[-n ops_per_thread] [-i initial_size] [-m min_size] [-c]\n");
+    exit (1);
+}
+
+int main (int argc, char ** argv) {
+    uint32_t max_threads = 8;
+    uint8_t initial_size = 22;
+    uint8_t min_size = 5;
+    int csv = 0;
+    int opt = 0;
+    uint32_t i = 0;
+
+    while ((opt = getopt (argc, argv, "t:n:i:m:c")) != -1) {
+    	if (opt == 't') {
+    		max_threads = atoi (optarg);
+    	} else if (opt == 'n') {
+    		ops_per_thread = atoi (optarg);
+    	} else if (opt == 'i') {
+    		initial_size = atoi (optarg);
+    	} else if (opt == 'm') {
+    		min_size = atoi (optarg);
+    	} else if (opt == 'c') {
+    		csv = 1;
+    	} else {
+    		usage ();
+    	}
+    }
+    if (max_threads == 0 || max_threads > MAX_THREADS ||
+        initial_size < min_size || initial_size > 30) {
+    	usage ();
+    }
+
+    for (i = 0; i < MAX_THREADS / 2 + 1; i ++) {
+    	pthread_mutex_init (&rings [i].lock, NULL);
+    	pthread_cond_init (&rings [i].not_empty, NULL);
+    	pthread_cond_init (&rings [i].not_full, NULL);
+    }
+    for (i = 0; i < SHARED_SLOTS; i ++) {
+    	pthread_mutex_init (&shared [i].lock, NULL);
+    }
+
+    // thread counts 1, 2, 4, ... and max_threads itself.
+    uint32_t counts [32];
+    uint32_t ncounts = 0;
+    for (i = 1; i < max_threads; i *= 2) {
+    	counts [ncounts ++] = i;
+    }
+    counts [ncounts ++] = max_threads;
+
+    struct pattern patterns [] = {
+    	{ "local", run_local },
+    	{ "prodcons", run_prodcons },
+    	{ "shared", run_shared },
+    };
+    uint32_t npatterns = sizeof (patterns) / sizeof (patterns [0]);
+    double results [3][32];
+    uint64_t failed [3][32];
+    double best = 0.0;
+    uint32_t p = 0;
+    uint32_t c = 0;
+
+    for (p = 0; p < npatterns; p ++) {
+    	for (c = 0; c < ncounts; c ++) {
+    		results [p][c] = run (&patterns [p], counts [c], initial_size,
+    				      min_size, &failed [p][c]);
+    		if (results [p][c] > best) {
+    			best = results [p][c];
+    		}
+    	}
+    }
+
+    if (csv) {
+    	printf ("pattern,threads,ops_per_sec,failed\n");
+    	for (p = 0; p < npatterns; p ++) {
+    		for (c = 0; c < ncounts; c ++) {
+    			printf ("%s,%u,%.0f,%lu\n", patterns [p].name,
+    				counts [c], results [p][c], failed [p][c]);
+    		}
+    	}
+    	return 0;
+    }
+
+    printf ("heap 2^%u, min block 2^%u, %u ops per thread, "
+            "requests 1-%u bytes\n", initial_size, min_size, ops_per_thread,
+            max_request);
+    for (p = 0; p < npatterns; p ++) {
+    	printf ("\n%s\n", patterns [p].name);
+    	for (c = 0; c < ncounts; c ++) {
+    		char bar [41];
+    		int width = best > 0 ? (int) (results [p][c] / best * 40) : 0;
+    		memset (bar, '#', width);
+    		bar [width] = '\0';
+    		printf ("%4u threads %12.0f ops/s %8lu failed  |%s\n",
+    			counts [c], results [p][c], failed [p][c], bar);
+    	}
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "bench_util.h"
+#include "virtual_sbrk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint8_t *arena = NULL;
+static uint64_t arena_size = 0;
+static uint64_t current_size = 0;
+static uint64_t peak_size = 0;
+
+/*
+This function moves the program break of the benchmark arena. It fails
+in the same way as the real sbrk when the arena is exhausted.
+
+parameters:
+increment - number of bytes to move the program break by (int32_t)
+
+return: (void*)
+on failure - it returns (void *)(-1).
+on success - it returns the previous program break.
+*/
+void * virtual_sbrk (int32_t increment) {
+    if ((int64_t) current_size + increment < 0 ||
+        current_size + increment > arena_size) {
+    	return (void *)(-1);
+    }
+    void *previous = arena + current_size;
+    current_size += increment;
+    if (current_size > peak_size) {
+    	peak_size = current_size;
+    }
+    return previous;
+}
+
+/*
+This function creates an arena large enough for a heap of the given
+geometry, including the largest possible metadata array, and returns
+its start to be passed to init_allocator. Any previous arena is freed.
+The arena is zero filled, so heaps in it may use VIRTUAL_ZEROED.
+
+parameters:
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+
+return: (void*)
+it returns the heapstart of the new arena. The program exits if the
+arena cannot be allocated.
+*/
+void * bench_heap_create (uint8_t initial_size, uint8_t min_size) {
+    bench_heap_destroy ();
+    // slack for the size byte, the page alignment of VIRTUAL_ALIGNED
+    // heaps, and the first entries of the data structure.
+    arena_size = ((uint64_t) 1 << initial_size) + 8192;
+    if (initial_size > min_size) {
+    	arena_size += (uint64_t) 1 << (initial_size - min_size);
+    }
+    arena = calloc (1, arena_size);
+    if (arena == NULL) {
+    	perror ("bench arena allocation failed\n");
+    	exit (1);
+    }
+    current_size = 0;
+    peak_size = 0;
+    return arena;
+}
+
+/*
+This function frees the arena created by bench_heap_create.
+
+return: void return type
+*/
+void bench_heap_destroy (void) {
+    free (arena);
+    arena = NULL;
+    arena_size = 0;
+    current_size = 0;
+}
+
+/*
+This function returns the highest program break seen since the arena
+was created, in bytes from heapstart. This is the heap footprint.
+
+return: (uint64_t) peak footprint in bytes
+*/
+uint64_t bench_heap_peak (void) {
+    return peak_size;
+}
+
+/*
+This function returns the current program break of the arena, in bytes
+from heapstart.
+
+return: (uint64_t) current footprint in bytes
+*/
+uint64_t bench_heap_break (void) {
+    return current_size;
+}
+
+/*
+This function returns a monotonic timestamp in nanoseconds.
+
+return: (uint64_t) current time in nanoseconds
+*/
+uint64_t bench_now_ns (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64 (const void * a, const void * b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+This function returns the p-th percentile of the samples, using the
+nearest rank method. The samples are sorted in place.
+
+parameters:
+samples - the samples (uint64_t*)
+count - number of samples (size_t)
+p - the percentile, between 0 and 100 (double)
+
+return: (uint64_t) the percentile, or 0 if there are no samples
+*/
+uint64_t bench_percentile (uint64_t * samples, size_t count, double p) {
+    if (count == 0) {
+    	return 0;
+    }
+    qsort (samples, count, sizeof (uint64_t), compare_u64);
+    size_t rank = (size_t) (p / 100.0 * count + 0.5);
+    if (rank == 0) {
+    	rank = 1;
+    }
+    if (rank > count) {
+    	rank = count;
+    }
+    return samples [rank - 1];
+}
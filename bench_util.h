@@ -0,0 +1,26 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Support code shared by the benchmark and replay drivers. It provides a
+virtual_sbrk implementation backed by one zero filled arena, so the drivers
+can create heaps of any geometry and measure their footprint, and a few
+timing and statistics helpers.
+*/
+
+void * bench_heap_create (uint8_t initial_size, uint8_t min_size);
+
+void bench_heap_destroy (void);
+
+uint64_t bench_heap_peak (void);
+
+uint64_t bench_heap_break (void);
+
+uint64_t bench_now_ns (void);
+
+uint64_t bench_percentile (uint64_t * samples, size_t count, double p);
+
+#endif
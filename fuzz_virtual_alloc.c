@@ -0,0 +1,870 @@
+#include "virtual_alloc.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Differential fuzzer for the buddy allocator.
+
+Every input describes a heap geometry and a sequence of operations. The
+operations are run through virtual_alloc.c and through a simple shadow
+model of the buddy allocator that keeps the blocks in an array of
+(order, allocated) pairs. After every step the harness checks that:
+  - both return the same block offsets and return codes,
+  - virtual_info prints exactly the block layout of the model,
+  - the program break matches the number of blocks in the model,
+  - the contents of every live block are untouched, realloc kept the
+    contents of the old block, and calloc returned zeroed memory.
+Any difference aborts, so the harness works with libFuzzer and AFL.
+
+On VIRTUAL_LAZY heaps the model leaves freed buddies unmerged too, and
+counts them against the watermark of their order, so the layout of the
+lazy heap is checked exactly, not just once it is coalesced. On
+VIRTUAL_LIFO heaps it remembers the blocks freed last like the
+allocator, so their reuse is checked down to the address. Allocations
+through virtual_malloc_ex are placed by their hints, and fail when the
+flags leave no block, like in the allocator.
+
+Input format:
+  byte 0 - bits 0-5 initial_size, modulo 17; bit 6 the VIRTUAL_LAZY
+           flag; bit 7 the VIRTUAL_ALIGNED layout
+  byte 1 - bits 0-5 min_size, modulo initial_size + 1; bit 6 the
+           VIRTUAL_LIFO flag; bit 7 the VIRTUAL_ZEROED flag (the arena
+           is zero filled)
+  then 4 bytes per operation:
+    byte 0 - operation: bits 0-1 malloc, calloc, free, realloc;
+             bits 2-3 pointer used by free/realloc: the slot's block,
+             the slot's block + 1, the slot's freed block, or NULL;
+             bits 4-5 at 2 turn it into virtual_malloc_ex, with
+             VIRTUAL_LONG_LIVED, VIRTUAL_SHORT_LIVED, VIRTUAL_ZERO and
+             VIRTUAL_EXACT_ORDER in bits 0-3, and VIRTUAL_NO_GROW in
+             bit 4 of byte 1, and if bit 5 of byte 1 is set
+             VIRTUAL_NO_SPLIT_ABOVE_ORDER(min_size + bits 6-7 of byte 1);
+             bits 4-5 at 3 turn it into virtual_coalesce if bits 6-7
+             are set too, and into virtual_set_watermark otherwise,
+             for the order in byte 1, modulo initial_size + 2, and the
+             count in bits 0-1 of the size
+    byte 1 - slot, modulo SLOTS; for realloc, bit 6 turns it into
+             virtual_relocate, and otherwise bit 5 turns it into
+             virtual_try_expand, or virtual_try_shrink if bit 4 is set
+    bytes 2-3 - size: an odd value v gives 2^(v >> 1 mod (initial + 2))
+                minus bit 6, an even value gives v >> 1 modulo the heap
+                size + 2, so exact powers, off by ones and too large
+                requests are all common. A free with bit 15 set is
+                sized, with the slot's size if bit 14 is set, or the
+                generated size otherwise.
+
+Building with -DFUZZ_LIBFUZZER leaves main out for libFuzzer. Otherwise
+main runs the files given on the command line, the input on stdin (for
+AFL), or with -r iterations [-s seed] generates random inputs and saves
+a failing one to fuzz-crash.bin.
+*/
+
+#define SLOTS 16
+#define MAX_INITIAL 16
+#define MAX_OPS 4096
+#define RECENT_SLOTS 16 // as in virtual_alloc.c
+
+struct model_block {
+    uint8_t order;
+    uint8_t allocated;
+};
+
+struct slot {
+    void *ptr; // live block, or NULL
+    void *stale; // last block freed from this slot
+    uint32_t size;
+    uint8_t fill;
+};
+
+static struct model_block model [((size_t) 1 << MAX_INITIAL) + 1];
+static uint32_t model_count = 0;
+static uint8_t model_initial = 0;
+static uint8_t model_min = 0;
+static uint32_t model_flags = 0;
+static uint32_t deferred [MAX_INITIAL + 1];
+static uint32_t watermark [MAX_INITIAL + 1];
+static uint64_t recent_offset [RECENT_SLOTS];
+static int32_t recent_order [RECENT_SLOTS];
+static uint32_t recent_top = 0;
+static uint64_t init_break = 0;
+
+static const uint8_t *current_input = NULL;
+static size_t current_size = 0;
+
+static void fail (const char * message, uint32_t step) {
+    fprintf (stderr, "fuzz_virtual_alloc: step %u: %s\n", step, message);
+    FILE *fp = fopen ("fuzz-crash.bin", "wb");
+    if (fp != NULL) {
+    	fwrite (current_input, 1, current_size, fp);
+    	fclose (fp);
+    }
+    abort ();
+}
+
+/* ---- shadow model ---- */
+
+static uint64_t model_offset (uint32_t index) {
+    uint64_t offset = 0;
+    uint32_t i = 0;
+    for (i = 0; i < index; i ++) {
+    	offset += (uint64_t) 1 << model [i].order;
+    }
+    return offset;
+}
+
+static void model_split (uint32_t index) {
+    memmove (&model [index + 1], &model [index],
+             (model_count - index) * sizeof (struct model_block));
+    model_count += 1;
+    model [index].order -= 1;
+    model [index + 1].order -= 1;
+}
+
+static void model_remove (uint32_t index) {
+    memmove (&model [index], &model [index + 1],
+             (model_count - index - 1) * sizeof (struct model_block));
+    model_count -= 1;
+}
+
+static int64_t model_find (uint64_t offset) {
+    uint64_t sum = 0;
+    uint32_t i = 0;
+    for (i = 0; i < model_count && sum <= offset; i ++) {
+    	if (sum == offset) {
+    		return i;
+    	}
+    	sum += (uint64_t) 1 << model [i].order;
+    }
+    return -1;
+}
+
+/*
+On lazy heaps, tells if the free block at index was left next to its
+free buddy of the same order.
+*/
+static int model_lazy_pair (int64_t index, uint64_t offset) {
+    uint32_t order = model [index].order;
+    int64_t mate = (offset & ((uint64_t) 1 << order)) ? index - 1 : index + 1;
+    return order < model_initial && mate >= 0 && mate < model_count &&
+    	   !model [mate].allocated && model [mate].order == order;
+}
+
+/*
+Merges every pair of free buddies, like virtual_coalesce, which also
+forgets the blocks waiting to be merged. It returns the number of
+merges.
+*/
+static uint64_t model_coalesce (void) {
+    uint32_t before = model_count;
+    uint32_t i = 0;
+    uint64_t offset = 0;
+    while (i + 1 < model_count) {
+    	uint32_t order = model [i].order;
+    	if (!model [i].allocated && !model [i + 1].allocated &&
+    	    model [i + 1].order == order && order < model_initial &&
+    	    offset % ((uint64_t) 2 << order) == 0) {
+    		model [i].order += 1;
+    		model_remove (i + 1);
+    		// the merged block may pair with the one before it.
+    		if (i > 0) {
+    			i -= 1;
+    			offset -= (uint64_t) 1 << model [i].order;
+    		}
+    		continue;
+    	}
+    	offset += (uint64_t) 1 << order;
+    	i += 1;
+    }
+    memset (deferred, 0, sizeof (deferred));
+    return before - model_count;
+}
+
+/*
+Allocates the free block at index, which on lazy heaps is no longer
+waiting to be merged if its buddy is free.
+*/
+static void model_take (int64_t index, uint64_t offset) {
+    uint32_t order = model [index].order;
+    if ((model_flags & VIRTUAL_LAZY) && deferred [order] > 0 &&
+        model_lazy_pair (index, offset)) {
+    	deferred [order] -= 1;
+    }
+    model [index].allocated = 1;
+}
+
+static void model_push (uint32_t order, uint64_t offset) {
+    recent_order [recent_top % RECENT_SLOTS] = order;
+    recent_offset [recent_top % RECENT_SLOTS] = offset;
+    recent_top += 1;
+}
+
+/*
+On LIFO heaps, the free block of order k freed last, if it is still
+free at that order. Every remembered block of order k looked at is
+forgotten. It returns the index, or -1.
+*/
+static int64_t model_recent (uint32_t k) {
+    uint32_t n = 0;
+    for (n = 1; n <= RECENT_SLOTS; n ++) {
+    	uint32_t slot = (recent_top - n) % RECENT_SLOTS;
+    	if (recent_order [slot] != k) {
+    		continue;
+    	}
+    	recent_order [slot] = -1;
+    	int64_t index = model_find (recent_offset [slot]);
+    	if (index >= 0 && !model [index].allocated &&
+    	    model [index].order == k) {
+    		return index;
+    	}
+    }
+    return -1;
+}
+
+static uint32_t model_order (uint32_t size) {
+    uint32_t k = model_min;
+    while (((uint64_t) 1 << k) < size) {
+    	k += 1;
+    }
+    return k;
+}
+
+/*
+The largest order a request of order k may split a free block of, with
+the flags of virtual_malloc_ex. The fuzzed heaps are not
+VIRTUAL_RESERVED, so VIRTUAL_NO_GROW does not split at all.
+*/
+static uint32_t model_top (uint32_t k, uint32_t flags) {
+    uint32_t top = MAX_INITIAL;
+    if (flags & VIRTUAL_NO_SPLIT_ABOVE_ORDER (0)) {
+    	top = (flags >> 8) & 0x3f;
+    	if (top < k) {
+    		top = k;
+    	}
+    }
+    if (flags & (VIRTUAL_EXACT_ORDER | VIRTUAL_NO_GROW)) {
+    	top = k;
+    }
+    return top;
+}
+
+/*
+The free block of order k up to top a request takes: the rightmost one
+for VIRTUAL_SHORT_LIVED, the leftmost one for VIRTUAL_LONG_LIVED, and
+otherwise the leftmost one of the smallest order. It returns the index,
+or -1.
+*/
+static int64_t model_best (uint32_t k, uint32_t top, uint32_t flags) {
+    int64_t best = -1;
+    uint32_t i = 0;
+    for (i = 0; i < model_count; i ++) {
+    	if (model [i].allocated || model [i].order < k ||
+    	    model [i].order > top) {
+    		continue;
+    	}
+    	if ((flags & VIRTUAL_SHORT_LIVED) || best < 0 ||
+    	    (!(flags & VIRTUAL_LONG_LIVED) &&
+    	     model [i].order < model [best].order)) {
+    		best = i;
+    	}
+    }
+    return best;
+}
+
+/*
+Allocates like virtual_malloc_ex, without VIRTUAL_ZERO. The block is
+chosen by model_best, or on LIFO heaps without a hint it is the one of
+that order freed last, and split down to the requested order, keeping
+the upper halves for VIRTUAL_SHORT_LIVED. Lazy heaps are coalesced
+first if nothing fits. It returns the offset, or -1 if nothing fits.
+*/
+static int64_t model_malloc_ex (uint32_t size, uint32_t flags) {
+    if (size == 0 || size > ((uint64_t) 1 << model_initial)) {
+    	return -1;
+    }
+    uint32_t k = model_order (size);
+    uint32_t top = model_top (k, flags);
+    int64_t best = model_best (k, top, flags);
+    if (best < 0 && (model_flags & VIRTUAL_LAZY) && model_coalesce () > 0) {
+    	best = model_best (k, top, flags);
+    }
+    if (best < 0) {
+    	return -1;
+    }
+    int hinted = flags & (VIRTUAL_LONG_LIVED | VIRTUAL_SHORT_LIVED);
+    if ((model_flags & VIRTUAL_LIFO) && !hinted) {
+    	int64_t recent = model_recent (model [best].order);
+    	if (recent >= 0) {
+    		best = recent;
+    	}
+    }
+    while (model [best].order > k) {
+    	model_split (best);
+    	if (flags & VIRTUAL_SHORT_LIVED) {
+    		best += 1;
+    	}
+    }
+    model_take (best, model_offset (best));
+    return model_offset (best);
+}
+
+static int64_t model_malloc (uint32_t size) {
+    return model_malloc_ex (size, 0);
+}
+
+/*
+Merges the free block at index with its free buddies, till possible,
+and returns the offset of the merged block.
+*/
+static int64_t model_merge (int64_t index, int64_t offset) {
+    while (model [index].order < model_initial) {
+    	uint64_t bit = (uint64_t) 1 << model [index].order;
+    	int64_t mate = (offset & bit) ? index - 1 : index + 1;
+    	if (mate < 0 || mate >= model_count || model [mate].allocated ||
+    	    model [mate].order != model [index].order) {
+    		break;
+    	}
+    	if (mate < index) {
+    		index = mate;
+    		offset -= bit;
+    	}
+    	model [index].order += 1;
+    	model_remove (index + 1);
+    }
+    return offset;
+}
+
+/*
+Frees the block at offset. On lazy heaps it is left unmerged, and every
+free buddy is merged once more pairs of its order wait than the
+watermark allows. On LIFO heaps the block is remembered, after it is
+merged.
+*/
+static int model_free (int64_t offset) {
+    int64_t index = (offset < 0) ? -1 : model_find (offset);
+    if (index < 0 || !model [index].allocated) {
+    	return 1;
+    }
+    model [index].allocated = 0;
+    if (model_flags & VIRTUAL_LAZY) {
+    	uint32_t order = model [index].order;
+    	if (model_flags & VIRTUAL_LIFO) {
+    		model_push (order, offset);
+    	}
+    	if (model_lazy_pair (index, offset) &&
+    	    ++ deferred [order] > watermark [order]) {
+    		model_coalesce ();
+    	}
+    	return 0;
+    }
+    offset = model_merge (index, offset);
+    if (model_flags & VIRTUAL_LIFO) {
+    	model_push (model [model_find (offset)].order, offset);
+    }
+    return 0;
+}
+
+static int model_set_watermark (uint32_t order, uint32_t count) {
+    if (order > model_initial) {
+    	return 1;
+    }
+    watermark [order] = count;
+    return 0;
+}
+
+static int model_free_sized (int64_t offset, uint32_t size) {
+    int64_t index = (offset < 0) ? -1 : model_find (offset);
+    uint32_t k = model_order (size);
+    if (index < 0 || size == 0 || model [index].order != k) {
+    	return 1;
+    }
+    return model_free (offset);
+}
+
+static int model_fits (int64_t index, uint32_t j, uint32_t k) {
+    uint32_t l = 0;
+    for (l = j; l < k; l ++) {
+    	uint32_t mate = index + 1 + l - j;
+    	if (mate >= model_count || model [mate].allocated ||
+    	    model [mate].order != l) {
+    		return 0;
+    	}
+    }
+    return 1;
+}
+
+/*
+In place resizing: expand merges the free buddies that follow the block,
+coalescing lazy heaps first if they do not match, shrink splits the
+block keeping its lower half. Both return the new block size, or 0 on
+failure.
+*/
+static uint64_t model_resize (int64_t offset, uint32_t size, int shrink) {
+    int64_t index = (offset < 0) ? -1 : model_find (offset);
+    if (index < 0 || !model [index].allocated || (shrink && size == 0)) {
+    	return 0;
+    }
+    uint32_t j = model [index].order;
+    uint32_t k = model_order (size);
+    uint32_t l = 0;
+    if (shrink) {
+    	if (k > j) {
+    		return 0;
+    	}
+    	while (model [index].order > k) {
+    		model_split (index);
+    		model [index + 1].allocated = 0;
+    	}
+    	return (uint64_t) 1 << k;
+    }
+    if (k <= j) {
+    	return (uint64_t) 1 << j;
+    }
+    if (k > model_initial || offset % ((int64_t) 1 << k) != 0) {
+    	return 0;
+    }
+    if (!model_fits (index, j, k)) {
+    	if (!(model_flags & VIRTUAL_LAZY) || model_coalesce () == 0) {
+    		return 0;
+    	}
+    	index = model_find (offset);
+    	if (!model_fits (index, j, k)) {
+    		return 0;
+    	}
+    }
+    for (l = j; l < k; l ++) {
+    	model_remove (index + 1);
+    }
+    model [index].order = k;
+    return (uint64_t) 1 << k;
+}
+
+/*
+Relocation: the block moves to the lowest free block below it that is
+large enough, split down to its order. It returns the new offset, or -1
+if offset is not an allocated block.
+*/
+static int64_t model_relocate (int64_t offset) {
+    int64_t index = (offset < 0) ? -1 : model_find (offset);
+    if (index < 0 || !model [index].allocated) {
+    	return -1;
+    }
+    uint32_t i = 0;
+    for (i = 0; i < index; i ++) {
+    	if (!model [i].allocated && model [i].order >= model [index].order) {
+    		break;
+    	}
+    }
+    if (i == index) {
+    	return offset;
+    }
+    uint32_t order = model [index].order;
+    while (model [i].order > order) {
+    	model_split (i);
+    	index += 1;
+    }
+    model [i].allocated = 1;
+    // the free may coalesce a lazy heap, moving the entries before i.
+    int64_t result = model_offset (i);
+    model_free (offset);
+    return result;
+}
+
+/*
+Allocates the block of the given order at offset again, splitting the
+free block that contains it.
+*/
+static void model_reserve (uint64_t offset, uint32_t order) {
+    uint32_t i = 0;
+    uint64_t sum = 0;
+    while (sum + ((uint64_t) 1 << model [i].order) <= offset) {
+    	sum += (uint64_t) 1 << model [i].order;
+    	i += 1;
+    }
+    while (model [i].order > order) {
+    	model_split (i);
+    	if (offset >= sum + ((uint64_t) 1 << model [i].order)) {
+    		sum += (uint64_t) 1 << model [i].order;
+    		i += 1;
+    	}
+    }
+    model [i].allocated = 1;
+}
+
+/*
+The old block is freed and merged, even on lazy heaps, and a new one is
+allocated. If that fails, the old block is allocated again.
+*/
+static int64_t model_realloc (int64_t offset, uint32_t size) {
+    int64_t index = (offset < 0) ? -1 : model_find (offset);
+    if (index < 0 || !model [index].allocated) {
+    	return -1;
+    }
+    uint32_t order = model [index].order;
+    model [index].allocated = 0;
+    model_merge (index, offset);
+    if (size == 0) {
+    	return -1;
+    }
+    int64_t result = model_malloc (size);
+    if (result < 0) {
+    	model_reserve (offset, order);
+    }
+    return result;
+}
+
+/* ---- checks ---- */
+
+static void check_layout (void * heapstart, uint32_t step) {
+    char *actual = NULL;
+    size_t actual_len = 0;
+    FILE *saved = stdout;
+    FILE *mem = open_memstream (&actual, &actual_len);
+    if (mem == NULL) {
+    	fail ("open_memstream failed", step);
+    }
+    stdout = mem;
+    virtual_info (heapstart);
+    fflush (mem);
+    stdout = saved;
+    fclose (mem);
+
+    char *expected = malloc (model_count * 32 + 1);
+    size_t len = 0;
+    uint32_t i = 0;
+    for (i = 0; i < model_count; i ++) {
+    	len += sprintf (expected + len, "%s %lu\n",
+    			model [i].allocated ? "allocated" : "free",
+    			(uint64_t) 1 << model [i].order);
+    }
+    expected [len] = '\0';
+    if (strcmp (actual, expected) != 0) {
+    	fprintf (stderr, "expected:\n%s\nactual:\n%s\n", expected, actual);
+    	fail ("virtual_info does not match the model", step);
+    }
+    free (actual);
+    free (expected);
+
+    if (virtual_check (heapstart) != 0) {
+    	fail ("virtual_check reports a damaged heap", step);
+    }
+
+    uint64_t expected_break = init_break + model_count - 1;
+    if (bench_heap_break () != expected_break) {
+    	fail ("program break does not match the number of blocks", step);
+    }
+}
+
+static void check_contents (struct slot * slots, uint32_t step) {
+    uint32_t i = 0;
+    uint32_t j = 0;
+    for (i = 0; i < SLOTS; i ++) {
+    	uint8_t *p = slots [i].ptr;
+    	for (j = 0; p != NULL && j < slots [i].size; j ++) {
+    		if (p [j] != slots [i].fill) {
+    			fail ("live block contents were overwritten", step);
+    		}
+    	}
+    }
+}
+
+static void check_offset (void * heapstart, void * ptr, int64_t expected,
+			  uint32_t step) {
+    int64_t actual = (ptr == NULL) ? -1 :
+    		     (int64_t) (ptr - virtual_data (heapstart));
+    if (actual != expected) {
+    	fprintf (stderr, "expected offset %ld, got %ld\n", expected, actual);
+    	fail ("returned block differs from the model", step);
+    }
+}
+
+/* ---- driver ---- */
+
+int LLVMFuzzerTestOneInput (const uint8_t * data, size_t size) {
+    struct slot slots [SLOTS];
+    uint32_t step = 0;
+    uint8_t fill = 0;
+
+    if (size < 2) {
+    	return 0;
+    }
+    current_input = data;
+    current_size = size;
+    model_initial = (data [0] & 0x3f) % (MAX_INITIAL + 1);
+    model_min = (data [1] & 0x3f) % (model_initial + 1);
+    model_flags = ((data [0] & 0x40) ? VIRTUAL_LAZY : 0) |
+    		  ((data [1] & 0x40) ? VIRTUAL_LIFO : 0) |
+    		  ((data [0] & 0x80) ? VIRTUAL_ALIGNED : 0) |
+    		  ((data [1] & 0x80) ? VIRTUAL_ZEROED : 0);
+    model [0].order = model_initial;
+    model [0].allocated = 0;
+    model_count = 1;
+    uint32_t i = 0;
+    for (i = 0; i <= MAX_INITIAL; i ++) {
+    	deferred [i] = 0;
+    	watermark [i] = 8; // LAZY_WATERMARK in virtual_alloc.c
+    }
+    for (i = 0; i < RECENT_SLOTS; i ++) {
+    	recent_order [i] = -1;
+    }
+    recent_top = 0;
+    memset (slots, 0, sizeof (slots));
+
+    void *heapstart = bench_heap_create (model_initial, model_min);
+    init_allocator_ex (heapstart, model_initial, model_min, model_flags);
+    init_break = bench_heap_break ();
+    check_layout (heapstart, 0);
+
+    size_t pos = 2;
+    for (step = 1; pos + 4 <= size && step <= MAX_OPS; step ++, pos += 4) {
+    	uint8_t op = data [pos] & 3;
+    	uint8_t which = (data [pos] >> 2) & 3;
+    	uint8_t kind = (data [pos] >> 4) & 3;
+    	struct slot *s = &slots [data [pos + 1] % SLOTS];
+    	uint32_t v = data [pos + 2] | (data [pos + 3] << 8);
+    	uint32_t request = 0;
+    	if (v & 1) {
+    		request = (1u << ((v >> 1) % (model_initial + 2))) -
+    			  ((v >> 6) & 1);
+    	} else {
+    		request = (v >> 1) % ((1u << model_initial) + 2);
+    	}
+
+    	void *ptr = s->ptr;
+    	if (op >= 2) {
+    		if (which == 1 && s->ptr != NULL) {
+    			ptr = s->ptr + 1;
+    		} else if (which == 2) {
+    			ptr = s->stale;
+    		} else if (which == 3) {
+    			ptr = NULL;
+    		}
+    	}
+    	int64_t offset = (ptr == NULL) ? -1 :
+    			 (int64_t) (ptr - virtual_data (heapstart));
+
+    	if (kind == 3 && (data [pos] >> 6) == 3) {
+    		if (virtual_coalesce (heapstart) != model_coalesce ()) {
+    			fail ("coalesce merged a different number of blocks",
+    			      step);
+    		}
+
+    	} else if (kind == 3) {
+    		uint32_t order = data [pos + 1] % (model_initial + 2);
+    		if (virtual_set_watermark (heapstart, order, v & 3) !=
+    		    model_set_watermark (order, v & 3)) {
+    			fail ("watermark return code differs from the model",
+    			      step);
+    		}
+
+    	} else if (op < 2 || kind == 2) {
+    		if (s->ptr != NULL) {
+    			// keeping the slot's block reachable for later frees.
+    			s = &slots [(data [pos + 1] + 1) % SLOTS];
+    			if (s->ptr != NULL) {
+    				continue;
+    			}
+    		}
+    		uint32_t flags = 0;
+    		uint64_t usable = 0;
+    		uint8_t *result = NULL;
+    		int64_t expected = -1;
+    		if (kind == 2) {
+    			flags = ((data [pos] & 1) ? VIRTUAL_LONG_LIVED : 0) |
+    				((data [pos] & 2) ? VIRTUAL_SHORT_LIVED : 0) |
+    				((data [pos] & 4) ? VIRTUAL_ZERO : 0) |
+    				((data [pos] & 8) ? VIRTUAL_EXACT_ORDER : 0) |
+    				((data [pos + 1] & 0x10) ? VIRTUAL_NO_GROW : 0);
+    			if (data [pos + 1] & 0x20) {
+    				flags |= VIRTUAL_NO_SPLIT_ABOVE_ORDER (model_min +
+    						(data [pos + 1] >> 6));
+    			}
+    			result = virtual_malloc_ex (heapstart, request, flags,
+    						    &usable);
+    			expected = model_malloc_ex (request,
+    						    flags & ~VIRTUAL_ZERO);
+    		} else {
+    			result = (op == 0) ?
+    				 virtual_malloc (heapstart, request) :
+    				 virtual_calloc (heapstart, 1, request);
+    			expected = model_malloc (request);
+    		}
+    		check_offset (heapstart, result, expected, step);
+    		uint64_t block = (result == NULL) ? 0 : (uint64_t) 1 <<
+    				 model [model_find (expected)].order;
+    		uint32_t i = 0;
+    		for (i = 0; kind != 2 && op == 1 && result != NULL &&
+    			    i < request; i ++) {
+    			if (result [i] != 0) {
+    				fail ("calloc returned a dirty block", step);
+    			}
+    		}
+    		for (i = 0; (flags & VIRTUAL_ZERO) && i < block; i ++) {
+    			if (result [i] != 0) {
+    				fail ("VIRTUAL_ZERO returned a dirty block", step);
+    			}
+    		}
+    		if (kind == 2 && usable != block) {
+    			fail ("usable size differs from the model", step);
+    		}
+    		if (result != NULL &&
+    		    virtual_usable_size (heapstart, result) != block) {
+    			fail ("usable size differs from the model", step);
+    		}
+    		if (result != NULL) {
+    			s->ptr = result;
+    			s->size = request;
+    			s->fill = ++ fill;
+    			memset (result, s->fill, request);
+    		}
+
+    	} else if (op == 2) {
+    		// the top bit frees with a size, the slot's own size or the
+    		// generated one.
+    		uint32_t sized = (v & 0x4000) ? s->size : request;
+    		int result = (v & 0x8000) ?
+    			     virtual_free_sized (heapstart, ptr, sized) :
+    			     virtual_free (heapstart, ptr);
+    		int expected = (v & 0x8000) ?
+    			       model_free_sized (offset, sized) :
+    			       model_free (offset);
+    		if (result != expected) {
+    			fail ("free return code differs from the model", step);
+    		}
+    		if (result == 0) {
+    			// the freed pointer belongs to a live slot.
+    			uint32_t i = 0;
+    			for (i = 0; i < SLOTS; i ++) {
+    				if (slots [i].ptr == ptr) {
+    					slots [i].stale = ptr;
+    					slots [i].ptr = NULL;
+    				}
+    			}
+    		}
+
+    	} else if (data [pos + 1] & 0x40) {
+    		void *result = virtual_relocate (heapstart, ptr);
+    		check_offset (heapstart, result, model_relocate (offset), step);
+    		uint32_t i = 0;
+    		for (i = 0; i < SLOTS && result != NULL; i ++) {
+    			if (slots [i].ptr == ptr) {
+    				slots [i].ptr = result;
+    			}
+    		}
+
+    	} else if (data [pos + 1] & 0x20) {
+    		// in place resizing, bit 4 of the slot byte picks shrink.
+    		int shrink = (data [pos + 1] >> 4) & 1;
+    		uint64_t result = shrink ?
+    				  virtual_try_shrink (heapstart, ptr, request) :
+    				  virtual_try_expand (heapstart, ptr, request);
+    		if (result != model_resize (offset, request, shrink)) {
+    			fail ("resized block size differs from the model", step);
+    		}
+    		uint32_t i = 0;
+    		for (i = 0; i < SLOTS && shrink && result != 0; i ++) {
+    			if (slots [i].ptr == ptr && slots [i].size > request) {
+    				slots [i].size = request;
+    			}
+    		}
+
+    	} else {
+    		struct slot *owner = NULL;
+    		uint32_t i = 0;
+    		for (i = 0; i < SLOTS && ptr != NULL; i ++) {
+    			if (slots [i].ptr == ptr) {
+    				owner = &slots [i];
+    			}
+    		}
+    		void *result = virtual_realloc (heapstart, ptr, request);
+    		check_offset (heapstart, result, model_realloc (offset, request),
+    			      step);
+    		if (owner != NULL && (result != NULL || request == 0)) {
+    			uint32_t kept = (request < owner->size) ?
+    					request : owner->size;
+    			uint8_t *p = result;
+    			for (i = 0; i < kept; i ++) {
+    				if (p [i] != owner->fill) {
+    					fail ("realloc lost the block contents",
+    					      step);
+    				}
+    			}
+    			owner->stale = owner->ptr;
+    			owner->ptr = result;
+    			owner->size = request;
+    			owner->fill = ++ fill;
+    			if (result != NULL) {
+    				memset (result, owner->fill, request);
+    			}
+    		}
+    	}
+    	check_layout (heapstart, step);
+    	check_contents (slots, step);
+    }
+    bench_heap_destroy ();
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+static int run_file (FILE * fp) {
+    static uint8_t buffer [2 + 4 * MAX_OPS];
+    size_t length = fread (buffer, 1, sizeof (buffer), fp);
+    return LLVMFuzzerTestOneInput (buffer, length);
+}
+
+int main (int argc, char ** argv) {
+    uint64_t iterations = 0;
+    uint64_t seed = 88172645463325252ull;
+    int first_file = 1;
+
+    while (first_file + 1 < argc && argv [first_file][0] == '-') {
+    	if (strcmp (argv [first_file], "-r") == 0) {
+    		iterations = strtoull (argv [first_file + 1], NULL, 10);
+    	} else if (strcmp (argv [first_file], "-s") == 0) {
+    		seed = strtoull (argv [first_file + 1], NULL, 10) | 1;
+    	} else {
+    		break;
+    	}
+    	first_file += 2;
+    }
+
+    if (iterations > 0) {
+    	static uint8_t buffer [2 + 4 * 1024];
+    	uint64_t n = 0;
+    	for (n = 0; n < iterations; n ++) {
+    		size_t length = 2 + 4 * (seed % 1024);
+    		size_t i = 0;
+    		for (i = 0; i < length; i ++) {
+    			seed ^= seed << 13;
+    			seed ^= seed >> 7;
+    			seed ^= seed << 17;
+    			buffer [i] = (uint8_t) seed;
+    		}
+    		// keeping most heaps small, so steps stay cheap, and
+    		// the flag bits as they are.
+    		buffer [0] = (buffer [0] & 0xc0) | (buffer [0] & 0x3f) % 13;
+    		LLVMFuzzerTestOneInput (buffer, length);
+    	}
+    	printf ("fuzz_virtual_alloc: %lu random inputs passed\n", iterations);
+    	return 0;
+    }
+
+    if (first_file >= argc) {
+    	return run_file (stdin);
+    }
+    int i = 0;
+    for (i = first_file; i < argc; i ++) {
+    	FILE *fp = fopen (argv [i], "rb");
+    	if (fp == NULL) {
+    		perror (argv [i]);
+    		return 1;
+    	}
+    	run_file (fp);
+    	fclose (fp);
+    }
+    return 0;
+}
+
+#endif
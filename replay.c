@@ -0,0 +1,353 @@
+#include "virtual_alloc.h"
+#include "virtual_trace.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+Replay driver for traces recorded with virtual_trace_start.
+
+usage: replay [-i initial_size] [-m min_size] [-s sample_interval] [-l]
+              [-p lowest|lifo] trace
+
+The trace is replayed against a fresh heap created with init_allocator,
+or init_allocator_ex with VIRTUAL_LAZY for -l, and VIRTUAL_LIFO for
+-p lifo, to compare the placement policies on the same trace.
+The heap geometry defaults to the one recorded in the trace header, and
+can be overridden to evaluate other sizes. Recorded offsets are mapped
+to the blocks returned during the replay, so the trace stays valid even
+when the replayed heap places blocks differently.
+
+It reports throughput, per operation latency percentiles, peak footprint
+and fragmentation, sampled every sample_interval operations.
+*/
+
+struct live_entry {
+    uint64_t key; // recorded offset, 0 if the slot is empty
+    void *ptr; // block returned during the replay, NULL if it failed
+    uint32_t size; // requested size
+};
+
+struct live_map {
+    struct live_entry *slots;
+    uint64_t mask;
+};
+
+static uint64_t hash (uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+static struct live_entry * map_find (struct live_map * map, uint64_t key) {
+    uint64_t i = hash (key) & map->mask;
+    while (map->slots [i].key != 0 && map->slots [i].key != key) {
+    	i = (i + 1) & map->mask;
+    }
+    return &map->slots [i];
+}
+
+/*
+This function removes the entry of the given key, moving later entries
+of the same probe chain back so that lookups keep working.
+*/
+static void map_remove (struct live_map * map, struct live_entry * entry) {
+    uint64_t i = entry - map->slots;
+    uint64_t j = i;
+    map->slots [i].key = 0;
+    while (1 > 0) {
+    	j = (j + 1) & map->mask;
+    	if (map->slots [j].key == 0) {
+    		return;
+    	}
+    	uint64_t home = hash (map->slots [j].key) & map->mask;
+    	// the entry at j can fill the hole at i only if its home slot
+    	// is not cyclically between i and j.
+    	if ((j > i && (home <= i || home > j)) ||
+    	    (j < i && (home <= i && home > j))) {
+    		map->slots [i] = map->slots [j];
+    		map->slots [j].key = 0;
+    		i = j;
+    	}
+    }
+}
+
+struct op_stats {
+    uint64_t *latency;
+    size_t count;
+};
+
+static void print_latency (const char * name, struct op_stats * s) {
+    if (s->count == 0) {
+    	return;
+    }
+    printf ("%-8s %10zu ops  p50 %6lu ns  p90 %6lu ns  p99 %7lu ns  "
+            "p99.9 %7lu ns  max %8lu ns\n", name, s->count,
+            bench_percentile (s->latency, s->count, 50),
+            bench_percentile (s->latency, s->count, 90),
+            bench_percentile (s->latency, s->count, 99),
+            bench_percentile (s->latency, s->count, 99.9),
+            bench_percentile (s->latency, s->count, 100));
+}
+
+static double external_fragmentation (struct virtual_stats * st) {
+    if (st->free_bytes == 0) {
+    	return 0.0;
+    }
+    return 1.0 - (double) st->largest_free / st->free_bytes;
+}
+
+static void usage (void) {
+    fprintf (stderr, "usage: replay [-i initial_size] [-m min_size] "
+             "[-s sample_interval] [-l] [-p lowest|lifo] trace\n");
+    exit (1);
+}
+
+int main (int argc, char ** argv) {
+    int initial_size = -1;
+    int min_size = -1;
+    uint64_t sample_interval = 1024;
+    uint32_t flags = 0;
+    int opt = 0;
+
+    while ((opt = getopt (argc, argv, "i:m:s:lp:")) != -1) {
+    	if (opt == 'i') {
+    		initial_size = atoi (optarg);
+    	} else if (opt == 'm') {
+    		min_size = atoi (optarg);
+    	} else if (opt == 's') {
+    		sample_interval = strtoull (optarg, NULL, 10);
+    	} else if (opt == 'l') {
+    		flags |= VIRTUAL_LAZY;
+    	} else if (opt == 'p' && strcmp (optarg, "lifo") == 0) {
+    		flags |= VIRTUAL_LIFO;
+    	} else if (opt == 'p' && strcmp (optarg, "lowest") == 0) {
+    		flags &= ~VIRTUAL_LIFO;
+    	} else {
+    		usage ();
+    	}
+    }
+    if (optind != argc - 1 || sample_interval == 0) {
+    	usage ();
+    }
+
+    // reading the whole trace up front, so file IO is not timed.
+    FILE *fp = fopen (argv [optind], "rb");
+    if (fp == NULL) {
+    	perror ("cannot open trace");
+    	return 1;
+    }
+    uint8_t header [TRACE_HEADER_SIZE];
+    if (fread (header, 1, TRACE_HEADER_SIZE, fp) != TRACE_HEADER_SIZE ||
+        memcmp (header, TRACE_MAGIC, 4) != 0 ||
+        trace_get (header + 4, 2) != TRACE_VERSION) {
+    	fprintf (stderr, "%s is not a version %d allocation trace\n",
+    		 argv [optind], TRACE_VERSION);
+    	return 1;
+    }
+    if (initial_size < 0) {
+    	initial_size = header [6];
+    }
+    if (min_size < 0) {
+    	min_size = header [7];
+    }
+    if (initial_size < min_size || initial_size > 40) {
+    	fprintf (stderr, "invalid heap geometry %d/%d\n", initial_size,
+    		 min_size);
+    	return 1;
+    }
+
+    fseek (fp, 0, SEEK_END);
+    long length = ftell (fp) - TRACE_HEADER_SIZE;
+    fseek (fp, TRACE_HEADER_SIZE, SEEK_SET);
+    size_t count = length / TRACE_RECORD_SIZE;
+    uint8_t *raw = malloc (count * TRACE_RECORD_SIZE + 1);
+    if (raw == NULL ||
+        fread (raw, TRACE_RECORD_SIZE, count, fp) != count) {
+    	fprintf (stderr, "cannot read trace records\n");
+    	return 1;
+    }
+    fclose (fp);
+
+    struct live_map map;
+    map.mask = 1024;
+    while (map.mask < count * 2) {
+    	map.mask <<= 1;
+    }
+    map.slots = calloc (map.mask, sizeof (struct live_entry));
+    map.mask -= 1;
+    struct op_stats all = { malloc ((count + 1) * sizeof (uint64_t)), 0 };
+    struct op_stats mallocs = { malloc ((count + 1) * sizeof (uint64_t)), 0 };
+    struct op_stats frees = { malloc ((count + 1) * sizeof (uint64_t)), 0 };
+    struct op_stats reallocs = { malloc ((count + 1) * sizeof (uint64_t)), 0 };
+    if (map.slots == NULL || all.latency == NULL || mallocs.latency == NULL ||
+        frees.latency == NULL || reallocs.latency == NULL) {
+    	fprintf (stderr, "out of memory\n");
+    	return 1;
+    }
+
+    void *heapstart = bench_heap_create (initial_size, min_size);
+    init_allocator_ex (heapstart, initial_size, min_size, flags);
+
+    uint64_t failed = 0;
+    uint64_t diverged = 0;
+    uint64_t skipped = 0;
+    uint64_t live_bytes = 0;
+    uint64_t peak_live_bytes = 0;
+    uint64_t peak_allocated_bytes = 0;
+    double peak_fragmentation = 0.0;
+    uint64_t total_ns = 0;
+    size_t n = 0;
+    struct virtual_stats st;
+
+    for (n = 0; n < count; n ++) {
+    	struct trace_record rec;
+    	trace_decode (raw + n * TRACE_RECORD_SIZE, &rec);
+    	uint64_t start = 0;
+    	uint64_t elapsed = 0;
+
+    	if (rec.op == TRACE_MALLOC) {
+    		start = bench_now_ns ();
+    		void *ptr = virtual_malloc (heapstart, rec.size);
+    		elapsed = bench_now_ns () - start;
+    		mallocs.latency [mallocs.count ++] = elapsed;
+    		if (ptr == NULL && rec.result != 0) {
+    			failed += 1;
+    		}
+    		if (ptr != NULL && rec.result == 0) {
+    			// failed when recorded, so nothing frees it later.
+    			virtual_free (heapstart, ptr);
+    			diverged += 1;
+    		}
+    		if (rec.result != 0) {
+    			struct live_entry *e = map_find (&map, rec.result);
+    			e->key = rec.result;
+    			e->ptr = ptr;
+    			e->size = (ptr == NULL) ? 0 : rec.size;
+    			live_bytes += e->size;
+    		}
+
+    	} else if (rec.op == TRACE_FREE) {
+    		struct live_entry *e = map_find (&map, rec.ptr);
+    		if (rec.ptr == 0 || e->key == 0 || e->ptr == NULL) {
+    			// freeing a block the replay never allocated.
+    			if (e->key != 0) {
+    				map_remove (&map, e);
+    			}
+    			skipped += 1;
+    			continue;
+    		}
+    		start = bench_now_ns ();
+    		int rc = virtual_free (heapstart, e->ptr);
+    		elapsed = bench_now_ns () - start;
+    		frees.latency [frees.count ++] = elapsed;
+    		if (rc != 0) {
+    			failed += 1;
+    		} else {
+    			live_bytes -= e->size;
+    			map_remove (&map, e);
+    		}
+
+    	} else if (rec.op == TRACE_REALLOC) {
+    		struct live_entry *e = map_find (&map, rec.ptr);
+    		void *old = NULL;
+    		if (rec.ptr != 0) {
+    			if (e->key == 0 || e->ptr == NULL) {
+    				skipped += 1;
+    				continue;
+    			}
+    			old = e->ptr;
+    		}
+    		start = bench_now_ns ();
+    		void *ptr = virtual_realloc (heapstart, old, rec.size);
+    		elapsed = bench_now_ns () - start;
+    		reallocs.latency [reallocs.count ++] = elapsed;
+
+    		if (ptr != NULL || rec.size == 0) {
+    			if (old != NULL) {
+    				live_bytes -= e->size;
+    				map_remove (&map, e);
+    			}
+    		}
+    		if (ptr == NULL && rec.result != 0) {
+    			failed += 1;
+    		}
+    		if (ptr != NULL && rec.result == 0) {
+    			// failed when recorded, so the trace goes on with the
+    			// old block, which now lives at ptr.
+    			diverged += 1;
+    			if (old == NULL) {
+    				virtual_free (heapstart, ptr);
+    			} else {
+    				e = map_find (&map, rec.ptr);
+    				e->key = rec.ptr;
+    				e->ptr = ptr;
+    				e->size = rec.size;
+    				live_bytes += rec.size;
+    			}
+    		}
+    		if (ptr != NULL && rec.result != 0) {
+    			e = map_find (&map, rec.result);
+    			e->key = rec.result;
+    			e->ptr = ptr;
+    			e->size = rec.size;
+    			live_bytes += rec.size;
+    		}
+
+    	} else {
+    		fprintf (stderr, "corrupt record %zu\n", n);
+    		return 1;
+    	}
+
+    	all.latency [all.count ++] = elapsed;
+    	total_ns += elapsed;
+    	if (live_bytes > peak_live_bytes) {
+    		peak_live_bytes = live_bytes;
+    	}
+    	if ((n + 1) % sample_interval == 0) {
+    		virtual_stats (heapstart, &st);
+    		if (st.allocated_bytes > peak_allocated_bytes) {
+    			peak_allocated_bytes = st.allocated_bytes;
+    		}
+    		double frag = external_fragmentation (&st);
+    		if (frag > peak_fragmentation) {
+    			peak_fragmentation = frag;
+    		}
+    	}
+    }
+
+    virtual_stats (heapstart, &st);
+    if (st.allocated_bytes > peak_allocated_bytes) {
+    	peak_allocated_bytes = st.allocated_bytes;
+    }
+
+    printf ("trace %s: %zu records, heap 2^%d, min block 2^%d\n",
+            argv [optind], count, initial_size, min_size);
+    printf ("throughput %.0f ops/s (%lu ns in allocator)\n",
+            total_ns ? all.count * 1e9 / total_ns : 0.0, total_ns);
+    print_latency ("all", &all);
+    print_latency ("malloc", &mallocs);
+    print_latency ("free", &frees);
+    print_latency ("realloc", &reallocs);
+    printf ("failed %lu, diverged %lu, skipped %lu\n", failed, diverged,
+            skipped);
+    printf ("peak footprint %lu bytes, peak live %lu bytes, "
+            "peak allocated %lu bytes\n", bench_heap_peak (),
+            peak_live_bytes, peak_allocated_bytes);
+    printf ("fragmentation: external %.3f (peak %.3f), internal %.3f\n",
+            external_fragmentation (&st), peak_fragmentation,
+            st.allocated_bytes ?
+            1.0 - (double) live_bytes / st.allocated_bytes : 0.0);
+
+    bench_heap_destroy ();
+    free (all.latency);
+    free (mallocs.latency);
+    free (frees.latency);
+    free (reallocs.latency);
+    free (map.slots);
+    free (raw);
+    return 0;
+}
@@ -8,6 +8,15 @@
 #include <string.h>
 #include "cmocka.h"
 #include "virtual_alloc.h"
+#include "virtual_trace.h"
+#include "virtual_region.h"
+#include "virtual_pool.h"
+#include "virtual_handle.h"
+#include "virtual_persist.h"
+#include "virtual_shm.h"
+#include "virtual_huge.h"
+#include <sys/wait.h>
+#include <unistd.h>
 
 /*Each test case checks for the return values of the functions called,
 the program break, contents of the memory, and  virtual info result.
@@ -603,6 +612,1037 @@ static void test_integrated_long (void** state) {
     test_virtual_info ();
 }
 
+static void test_trace_record (void** state) {
+    init_allocator (heap_start, 15, 12);
+    assert_int_equal (virtual_trace_start (virtual_heap, "out_trace"), 0);
+    void* result = virtual_malloc (virtual_heap, 1000);
+    test_program_break (result);
+    void* result2 = virtual_realloc (virtual_heap, result, 5000);
+    test_program_break (result2);
+    virtual_free (virtual_heap, result2);
+    virtual_trace_stop ();
+    // not recorded after the trace is stopped
+    virtual_malloc (virtual_heap, 1000);
+    
+    FILE *fp = fopen ("out_trace", "rb");
+    assert_non_null (fp);
+    uint8_t buffer [TRACE_HEADER_SIZE + 4 * TRACE_RECORD_SIZE];
+    size_t length = fread (buffer, 1, sizeof (buffer), fp);
+    fclose (fp);
+    remove ("out_trace");
+    assert_int_equal (length, TRACE_HEADER_SIZE + 3 * TRACE_RECORD_SIZE);
+    assert_memory_equal (buffer, TRACE_MAGIC, 4);
+    assert_int_equal (buffer [6], 15);
+    assert_int_equal (buffer [7], 12);
+    
+    struct trace_record rec;
+    trace_decode (buffer + TRACE_HEADER_SIZE, &rec);
+    assert_int_equal (rec.op, TRACE_MALLOC);
+    assert_int_equal (rec.size, 1000);
+    assert_int_equal (rec.result, result - heap_start);
+    trace_decode (buffer + TRACE_HEADER_SIZE + TRACE_RECORD_SIZE, &rec);
+    assert_int_equal (rec.op, TRACE_REALLOC);
+    assert_int_equal (rec.size, 5000);
+    assert_int_equal (rec.ptr, result - heap_start);
+    assert_int_equal (rec.result, result2 - heap_start);
+    trace_decode (buffer + TRACE_HEADER_SIZE + 2 * TRACE_RECORD_SIZE, &rec);
+    assert_int_equal (rec.op, TRACE_FREE);
+    assert_int_equal (rec.ptr, result2 - heap_start);
+    assert_int_equal (rec.result, 0);
+    
+    expected = "allocated 4096\nfree 4096\nfree 8192\nfree 16384\n";
+    test_virtual_info ();
+}
+
+static void test_free_beyond_initial_size (void** state) {
+    init_allocator (heap_start, 10, 4);
+    void* blocks [20];
+    int i = 0;
+    for (i = 0; i < 20; i ++) {
+    	blocks [i] = virtual_malloc (virtual_heap, 16);
+    	test_program_break (blocks [i]);
+    }
+    // more blocks than initial_size come before this one
+    assert_int_equal (virtual_free (virtual_heap, blocks [18]), 0);
+    assert_int_equal (virtual_free (virtual_heap, blocks [19]), 0);
+    assert_int_equal (virtual_free (virtual_heap, blocks [19]), 1);
+    
+    expected = "allocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nallocated 16\nfree 32\nfree 64\nfree 128\nfree 512\n";
+    test_virtual_info ();
+}
+
+static void test_free_not_buddies (void** state) {
+    init_allocator (heap_start, 6, 4);
+    void* result = virtual_malloc (virtual_heap, 16);
+    void* result2 = virtual_malloc (virtual_heap, 16);
+    void* result3 = virtual_malloc (virtual_heap, 16);
+    void* result4 = virtual_malloc (virtual_heap, 16);
+    test_program_break (result4);
+    // neighbouring free blocks of the same size, but not buddies
+    virtual_free (virtual_heap, result2);
+    virtual_free (virtual_heap, result3);
+    
+    expected = "allocated 16\nfree 16\nfree 16\nallocated 16\n";
+    test_virtual_info ();
+    
+    virtual_free (virtual_heap, result);
+    virtual_free (virtual_heap, result4);
+    expected = "free 64\n";
+    test_virtual_info ();
+}
+
+static void test_realloc_restores_block (void** state) {
+    init_allocator (heap_start, 16, 12);
+    void* result = virtual_malloc (virtual_heap, 1000);
+    void* result2 = virtual_malloc (virtual_heap, 1000);
+    test_program_break (virtual_malloc (virtual_heap, 30000));
+    virtual_free (virtual_heap, result);
+    void* before = program_break;
+    add_value_malloc (result2, 4096);
+    // freeing result2 merges it up to 32768 bytes, which is still too
+    // small, so the block has to be split off again
+    void* result3 = virtual_realloc (virtual_heap, result2, 40000);
+    if (result3 != NULL) {
+    	assert_true (0);
+    }
+    check_value_realloc (result2, 4096);
+    assert_ptr_equal (program_break, before);
+    
+    expected = "free 4096\nallocated 4096\nfree 8192\nfree 16384\nallocated 32768\n";
+    test_virtual_info ();
+}
+
+static void test_aligned_layout (void** state) {
+    init_allocator_ex (heap_start, 16, 6, VIRTUAL_ALIGNED);
+    uint8_t* data = virtual_data (heap_start);
+    assert_true (((uintptr_t) data & 4095) == 0);
+    assert_true (data > (uint8_t *) heap_start);
+    assert_true ((uint8_t *) program_break > data + 65536);
+    void* before = program_break;
+    
+    void* result = virtual_malloc (virtual_heap, 100);
+    void* result2 = virtual_malloc (virtual_heap, 5000);
+    assert_ptr_equal (result, data);
+    assert_ptr_equal (result2, data + 8192);
+    assert_ptr_equal (program_break, before + 9);
+    
+    expected = "allocated 128\nfree 128\nfree 256\nfree 512\nfree 1024\n"
+    	       "free 2048\nfree 4096\nallocated 8192\nfree 16384\nfree 32768\n";
+    test_virtual_info ();
+}
+
+static void test_aligned_alloc (void** state) {
+    init_allocator_ex (heap_start, 16, 4, VIRTUAL_ALIGNED);
+    void* small = virtual_malloc (virtual_heap, 16);
+    void* result = virtual_aligned_alloc (virtual_heap, 256, 10);
+    void* result2 = virtual_aligned_alloc (virtual_heap, 4096, 5000);
+    assert_true (((uintptr_t) result & 255) == 0);
+    assert_true (((uintptr_t) result2 & 4095) == 0);
+    assert_ptr_equal (result, (uint8_t *) small + 256);
+    assert_null (virtual_aligned_alloc (virtual_heap, 48, 10));
+    assert_null (virtual_aligned_alloc (virtual_heap, 0, 10));
+    uintptr_t data = (uintptr_t) virtual_data (heap_start);
+    assert_null (virtual_aligned_alloc (virtual_heap, (data & -data) * 2, 10));
+    assert_int_equal (virtual_free (virtual_heap, result), 0);
+    
+    // the data region of the packed layout is only aligned to whatever
+    // heapstart + 1 happens to be
+    init_allocator (heap_start, 16, 4);
+    assert_null (virtual_aligned_alloc (virtual_heap, 64, 10));
+    assert_non_null (virtual_aligned_alloc (virtual_heap, 1, 10));
+}
+
+static void test_calloc_dirty (void** state) {
+    init_allocator (heap_start, 15, 10);
+    void* result = virtual_malloc (virtual_heap, 3000);
+    add_value_malloc (result, 3000);
+    virtual_free (virtual_heap, result);
+    uint8_t* result2 = virtual_calloc (virtual_heap, 100, 30);
+    assert_ptr_equal (result2, result);
+    uint32_t i = 0;
+    for (i = 0; i < 3000; i ++) {
+    	assert_int_equal (result2 [i], 0);
+    }
+    assert_null (virtual_calloc (virtual_heap, 65536, 65536));
+    assert_null (virtual_calloc (virtual_heap, 0, 10));
+    
+    expected = "allocated 4096\nfree 4096\nfree 8192\nfree 16384\n";
+    test_virtual_info ();
+}
+
+static void test_calloc_known_zero (void** state) {
+    memset (heap_start, 0, 100000);
+    init_allocator_ex (heap_start, 15, 10, VIRTUAL_ZEROED);
+    uint8_t* data = virtual_data (heap_start);
+    void* result = virtual_malloc (virtual_heap, 4096);
+    memset (result, 1, 4096);
+    virtual_free (virtual_heap, result);
+    // never allocated bytes are not cleared again, marking them shows
+    // that only the dirty start of the block is cleared
+    data [5000] = 2;
+    uint8_t* result2 = virtual_calloc (virtual_heap, 1, 8192);
+    assert_ptr_equal (result2, data);
+    assert_int_equal (result2 [0], 0);
+    assert_int_equal (result2 [4095], 0);
+    assert_int_equal (result2 [5000], 2);
+    
+    // once handed out, the whole block is dirty
+    virtual_free (virtual_heap, result2);
+    result2 = virtual_calloc (virtual_heap, 1, 8192);
+    assert_int_equal (result2 [5000], 0);
+}
+
+static void test_usable_size (void** state) {
+    init_allocator (heap_start, 15, 10);
+    void* result = virtual_malloc (virtual_heap, 1000);
+    void* result2 = virtual_malloc (virtual_heap, 3000);
+    assert_int_equal (virtual_usable_size (virtual_heap, result), 1024);
+    assert_int_equal (virtual_usable_size (virtual_heap, result2), 4096);
+    assert_int_equal (virtual_usable_size (virtual_heap, result + 1), 0);
+    assert_int_equal (virtual_usable_size (virtual_heap, NULL), 0);
+    virtual_free (virtual_heap, result);
+    assert_int_equal (virtual_usable_size (virtual_heap, result), 0);
+}
+
+static void test_free_sized (void** state) {
+    init_allocator (heap_start, 15, 10);
+    void* result = virtual_malloc (virtual_heap, 1000);
+    void* result2 = virtual_malloc (virtual_heap, 3000);
+    void* result3 = virtual_malloc (virtual_heap, 3000);
+    // sizes of another order, or pointers that are not blocks, fail
+    assert_int_equal (virtual_free_sized (virtual_heap, result2, 1000), 1);
+    assert_int_equal (virtual_free_sized (virtual_heap, result2, 5000), 1);
+    assert_int_equal (virtual_free_sized (virtual_heap, result2 + 1024, 1000), 1);
+    assert_int_equal (virtual_free_sized (virtual_heap, result2, 0), 1);
+    // any size up to the usable size works
+    assert_int_equal (virtual_free_sized (virtual_heap, result2, 4096), 0);
+    assert_int_equal (virtual_free_sized (virtual_heap, result2, 4096), 1);
+    assert_int_equal (virtual_free_sized (virtual_heap, result, 1), 0);
+    
+    expected = "free 8192\nallocated 4096\nfree 4096\nfree 16384\n";
+    test_virtual_info ();
+    assert_int_equal (virtual_free_sized (virtual_heap, result3, 3000), 0);
+    expected = "free 32768\n";
+    test_virtual_info ();
+}
+
+static void test_try_expand (void** state) {
+    init_allocator (heap_start, 15, 10);
+    void* result = virtual_malloc (virtual_heap, 1000);
+    add_value_malloc (result, 1000);
+    void* before = program_break;
+    assert_int_equal (virtual_try_expand (virtual_heap, result, 500), 1024);
+    assert_int_equal (virtual_try_expand (virtual_heap, result, 8000), 8192);
+    assert_ptr_equal (program_break, before - 3);
+    check_value_realloc (result, 1000);
+    expected = "allocated 8192\nfree 8192\nfree 16384\n";
+    test_virtual_info ();
+    
+    // the block after it is in use, and blocks not aligned to the new
+    // size cannot grow either
+    void* result2 = virtual_malloc (virtual_heap, 8000);
+    assert_int_equal (virtual_try_expand (virtual_heap, result, 10000), 0);
+    assert_int_equal (virtual_try_expand (virtual_heap, result2, 10000), 0);
+    assert_int_equal (virtual_try_expand (virtual_heap, result2 + 1, 100), 0);
+    assert_int_equal (virtual_try_expand (virtual_heap, result, 40000), 0);
+    expected = "allocated 8192\nallocated 8192\nfree 16384\n";
+    test_virtual_info ();
+}
+
+static void test_try_shrink (void** state) {
+    init_allocator (heap_start, 15, 10);
+    void* result = virtual_malloc (virtual_heap, 10000);
+    add_value_malloc (result, 1000);
+    void* before = program_break;
+    assert_int_equal (virtual_try_shrink (virtual_heap, result, 20000), 0);
+    assert_int_equal (virtual_try_shrink (virtual_heap, result, 0), 0);
+    assert_int_equal (virtual_try_shrink (virtual_heap, result, 9000), 16384);
+    assert_int_equal (virtual_try_shrink (virtual_heap, result, 1000), 1024);
+    assert_ptr_equal (program_break, before + 4);
+    check_value_realloc (result, 1000);
+    expected = "allocated 1024\nfree 1024\nfree 2048\nfree 4096\nfree 8192\nfree 16384\n";
+    test_virtual_info ();
+    
+    // the freed parts merge back once the block is freed
+    virtual_free (virtual_heap, result);
+    expected = "free 32768\n";
+    test_virtual_info ();
+}
+
+static void test_region_alloc (void** state) {
+    init_allocator (heap_start, 16, 6);
+    struct region* region = region_create (virtual_heap, 1000);
+    assert_non_null (region);
+    uint8_t* result = region_alloc (region, 100);
+    uint8_t* result2 = region_alloc (region, 100);
+    assert_true (((uintptr_t) result & 15) == 0);
+    assert_true (result2 >= result + 100 && result2 < result + 116);
+    assert_null (region_alloc (region, 0));
+    // objects larger than a chunk get their own
+    uint8_t* result3 = region_alloc (region, 5000);
+    assert_non_null (result3);
+    memset (result3, 1, 5000);
+    expected = "allocated 2048\nfree 2048\nfree 4096\nallocated 8192\n"
+    	       "free 16384\nfree 32768\n";
+    test_virtual_info ();
+    
+    region_destroy (region);
+    expected = "free 65536\n";
+    test_virtual_info ();
+}
+
+static void test_region_reset (void** state) {
+    init_allocator (heap_start, 16, 6);
+    struct region* region = region_create (virtual_heap, 1000);
+    uint8_t* result = region_alloc (region, 800);
+    region_alloc (region, 800);
+    uint8_t* result3 = region_alloc (region, 800);
+    expected = "allocated 2048\nallocated 2048\nfree 4096\nfree 8192\n"
+    	       "free 16384\nfree 32768\n";
+    test_virtual_info ();
+    
+    // reset keeps the chunks and hands out the same memory again
+    region_reset (region);
+    assert_ptr_equal (region_alloc (region, 800), result);
+    region_alloc (region, 800);
+    assert_ptr_equal (region_alloc (region, 800), result3);
+    test_virtual_info ();
+    region_destroy (region);
+}
+
+static void test_pool_get_put (void** state) {
+    init_allocator (heap_start, 16, 6);
+    assert_null (pool_create (virtual_heap, 0, 8));
+    assert_null (pool_create (virtual_heap, 64, 24));
+    struct pool* pool = pool_create (virtual_heap, 192, 64);
+    assert_non_null (pool);
+    uint8_t* result = pool_get (pool);
+    uint8_t* result2 = pool_get (pool);
+    assert_true (((uintptr_t) result & 63) == 0);
+    assert_ptr_equal (result2, result + 192);
+    memset (result, 1, 192);
+    memset (result2, 2, 192);
+    assert_int_equal (result2 [0], 2);
+    
+    // objects are reused last in, first out
+    assert_int_equal (pool_put (pool, result), 0);
+    assert_ptr_equal (pool_get (pool), result);
+    assert_int_equal (pool_put (pool, result + 1), 1);
+    assert_int_equal (pool_put (pool, result2 + 192), 1);
+    assert_int_equal (pool_put (pool, NULL), 1);
+    // one pool block and one 8192 byte slab are taken from the heap
+    expected = "allocated 128\nfree 128\nfree 256\nfree 512\nfree 1024\n"
+    	       "free 2048\nfree 4096\nallocated 8192\nfree 16384\n"
+    	       "free 32768\n";
+    test_virtual_info ();
+    pool_destroy (pool);
+    expected = "free 65536\n";
+    test_virtual_info ();
+}
+
+static void test_pool_slabs (void** state) {
+    init_allocator (heap_start, 16, 6);
+    struct pool* pool = pool_create (virtual_heap, 64, 8);
+    void* objects [200];
+    uint32_t i = 0;
+    for (i = 0; i < 200; i ++) {
+    	objects [i] = pool_get (pool);
+    	assert_non_null (objects [i]);
+    }
+    // 4096 byte slabs, of 62 objects each
+    expected = "allocated 128\nfree 128\nfree 256\nfree 512\nfree 1024\n"
+    	       "free 2048\nallocated 4096\nallocated 4096\nallocated 4096\n"
+    	       "allocated 4096\nfree 4096\nfree 8192\nfree 32768\n";
+    test_virtual_info ();
+    
+    // empty slabs go back to the heap, except one spare
+    for (i = 0; i < 200; i ++) {
+    	assert_int_equal (pool_put (pool, objects [i]), 0);
+    }
+    assert_int_equal (pool_put (pool, objects [0]), 1);
+    expected = "allocated 128\nfree 128\nfree 256\nfree 512\nfree 1024\n"
+    	       "free 2048\nallocated 4096\nfree 8192\nfree 16384\n"
+    	       "free 32768\n";
+    test_virtual_info ();
+    pool_destroy (pool);
+}
+
+static void test_relocate (void** state) {
+    init_allocator (heap_start, 15, 10);
+    void* result = virtual_malloc (virtual_heap, 1000);
+    void* result2 = virtual_malloc (virtual_heap, 1000);
+    void* result3 = virtual_malloc (virtual_heap, 1000);
+    add_value_malloc (result3, 1000);
+    virtual_free (virtual_heap, result2);
+    assert_ptr_equal (virtual_relocate (virtual_heap, result), result);
+    assert_ptr_equal (virtual_relocate (virtual_heap, result3), result2);
+    check_value_realloc (result2, 1000);
+    assert_null (virtual_relocate (virtual_heap, result3));
+    assert_null (virtual_relocate (virtual_heap, result2 + 1));
+    
+    expected = "allocated 1024\nallocated 1024\nfree 2048\nfree 4096\n"
+    	       "free 8192\nfree 16384\n";
+    test_virtual_info ();
+}
+
+static void test_handle_pin (void** state) {
+    init_allocator (heap_start, 16, 6);
+    struct handle_table* table = handle_table_create (virtual_heap, 2);
+    virtual_handle handle = handle_alloc (table, 100);
+    virtual_handle handle2 = handle_alloc (table, 100);
+    assert_true (handle != 0 && handle2 != 0 && handle != handle2);
+    assert_int_equal (handle_alloc (table, 100), 0);
+    
+    void* ptr = handle_pin (table, handle);
+    assert_non_null (ptr);
+    assert_ptr_equal (handle_pin (table, handle), ptr);
+    assert_int_equal (handle_free (table, handle), 1);
+    assert_int_equal (handle_unpin (table, handle), 0);
+    assert_int_equal (handle_unpin (table, handle), 0);
+    assert_int_equal (handle_unpin (table, handle), 1);
+    
+    // a freed handle stays invalid when its entry is reused
+    assert_int_equal (handle_free (table, handle), 0);
+    assert_null (handle_pin (table, handle));
+    virtual_handle handle3 = handle_alloc (table, 100);
+    assert_true (handle3 != 0 && handle3 != handle);
+    assert_null (handle_pin (table, handle));
+    assert_int_equal (handle_free (table, handle), 1);
+    assert_int_equal (handle_free (table, 0), 1);
+    
+    handle_table_destroy (table);
+    expected = "free 65536\n";
+    test_virtual_info ();
+}
+
+static void test_handle_compact (void** state) {
+    init_allocator (heap_start, 16, 10);
+    struct handle_table* table = handle_table_create (virtual_heap, 64);
+    virtual_handle handles [60];
+    uint32_t i = 0;
+    // the table takes the first 4096 bytes, the handles the rest
+    for (i = 0; i < 60; i ++) {
+    	handles [i] = handle_alloc (table, 1000);
+    	uint8_t* ptr = handle_pin (table, handles [i]);
+    	memset (ptr, i, 1000);
+    	handle_unpin (table, handles [i]);
+    }
+    // every other block is freed, so no 2048 byte block is free
+    for (i = 1; i < 60; i += 2) {
+    	handle_free (table, handles [i]);
+    }
+    assert_null (virtual_malloc (virtual_heap, 2000));
+    // a pinned block stays where it is
+    uint8_t* pinned = handle_pin (table, handles [58]);
+    
+    assert_true (handle_compact (table) > 0);
+    assert_int_equal (handle_compact (table), 0);
+    for (i = 0; i < 60; i += 2) {
+    	uint8_t* ptr = handle_pin (table, handles [i]);
+    	assert_int_equal (ptr [0], i);
+    	assert_int_equal (ptr [999], i);
+    	handle_unpin (table, handles [i]);
+    }
+    assert_ptr_equal (handle_pin (table, handles [58]), pinned);
+    void* big = virtual_malloc (virtual_heap, 8000);
+    assert_non_null (big);
+    virtual_free (virtual_heap, big);
+    handle_table_destroy (table);
+}
+
+static void test_defrag_step (void** state) {
+    init_allocator (heap_start, 16, 10);
+    // without a mover nothing can be moved
+    assert_int_equal (virtual_defrag_step (virtual_heap, 1000000), 0);
+    struct handle_table* table = handle_table_create (virtual_heap, 64);
+    virtual_handle handles [60];
+    uint32_t i = 0;
+    for (i = 0; i < 60; i ++) {
+    	handles [i] = handle_alloc (table, 1000);
+    	uint8_t* ptr = handle_pin (table, handles [i]);
+    	memset (ptr, i, 1000);
+    	handle_unpin (table, handles [i]);
+    }
+    for (i = 1; i < 60; i += 2) {
+    	handle_free (table, handles [i]);
+    }
+    assert_null (virtual_malloc (virtual_heap, 2000));
+    uint8_t* pinned = handle_pin (table, handles [58]);
+    
+    // with no time to spend, every step still moves one block
+    assert_int_equal (virtual_defrag_step (virtual_heap, 0), 1);
+    uint32_t steps = 1;
+    while (virtual_defrag_step (virtual_heap, 0) > 0) {
+    	steps += 1;
+    	assert_true (steps < 100);
+    }
+    for (i = 0; i < 60; i += 2) {
+    	uint8_t* ptr = handle_pin (table, handles [i]);
+    	assert_int_equal (ptr [0], i);
+    	assert_int_equal (ptr [999], i);
+    	handle_unpin (table, handles [i]);
+    }
+    assert_ptr_equal (handle_pin (table, handles [58]), pinned);
+    void* big = virtual_malloc (virtual_heap, 16000);
+    assert_non_null (big);
+    virtual_free (virtual_heap, big);
+    handle_table_destroy (table);
+    assert_int_equal (virtual_defrag_step (virtual_heap, 1000000), 0);
+}
+
+// lets every block be moved, but refuses when it is, counting the calls
+static int refusing_mover (void* ctx, void* from, void* to) {
+    if (to == NULL) {
+    	return 1;
+    }
+    * (uint32_t*) ctx += 1;
+    return 0;
+}
+
+static void test_defrag_refused (void** state) {
+    init_allocator (heap_start, 16, 10);
+    uint8_t* ptrs [60];
+    uint32_t i = 0;
+    for (i = 0; i < 60; i ++) {
+    	ptrs [i] = virtual_malloc (heap_start, 1000);
+    	memset (ptrs [i], i, 1000);
+    }
+    for (i = 1; i < 60; i += 2) {
+    	assert_int_equal (virtual_free (heap_start, ptrs [i]), 0);
+    }
+    uint32_t refused = 0;
+    virtual_set_mover (heap_start, refusing_mover, &refused);
+    assert_int_equal (virtual_defrag_step (heap_start, 1000000), 0);
+    assert_int_equal (refused, 1);
+    
+    // the blocks stay where they were, and the copy was given back
+    struct virtual_stats stats;
+    virtual_stats (heap_start, &stats);
+    assert_int_equal (stats.allocated_blocks, 30);
+    for (i = 0; i < 60; i += 2) {
+    	assert_int_equal (virtual_usable_size (heap_start, ptrs [i]), 1024);
+    	assert_int_equal (ptrs [i][999], i);
+    }
+    assert_int_equal (virtual_check (heap_start), 0);
+}
+
+#define PERSIST_PATH "/tmp/virtual_alloc_test.heap"
+
+static void test_persist_attach (void** state) {
+    unlink (PERSIST_PATH);
+    void* before = program_break;
+    void* heap = virtual_create (PERSIST_PATH, 16, 10, VIRTUAL_ALIGNED);
+    assert_non_null (heap);
+    // the file is not replaced
+    assert_null (virtual_create (PERSIST_PATH, 16, 10, 0));
+    uint8_t* data = virtual_data (heap);
+    uint8_t* ptr = virtual_malloc (heap, 3000);
+    void* ptr2 = virtual_malloc (heap, 1000);
+    assert_non_null (ptr2);
+    memset (ptr, 7, 3000);
+    uint64_t offset = ptr - data;
+    struct virtual_stats stats;
+    virtual_stats (heap, &stats);
+    assert_int_equal (virtual_detach (heap), 0);
+    
+    heap = virtual_attach (PERSIST_PATH);
+    assert_non_null (heap);
+    struct virtual_stats stats2;
+    virtual_stats (heap, &stats2);
+    assert_memory_equal (&stats, &stats2, sizeof (stats));
+    ptr = (uint8_t*) virtual_data (heap) + offset;
+    assert_int_equal (ptr [0], 7);
+    assert_int_equal (ptr [2999], 7);
+    // the heap goes on where it was left
+    assert_int_equal (virtual_free (heap, ptr), 0);
+    assert_int_equal (virtual_free (heap, ptr), 1);
+    assert_non_null (virtual_malloc (heap, 16000));
+    // the program break is never touched
+    assert_ptr_equal (program_break, before);
+    assert_int_equal (virtual_detach (heap), 0);
+    unlink (PERSIST_PATH);
+}
+
+static void test_persist_damaged (void** state) {
+    unlink (PERSIST_PATH);
+    assert_null (virtual_attach (PERSIST_PATH));
+    void* heap = virtual_create (PERSIST_PATH, 16, 10, 0);
+    assert_non_null (heap);
+    assert_non_null (virtual_malloc (heap, 1000));
+    // a block that is not aligned to its size
+    const uint8_t entries [] = {10, 80, 10, 11};
+    uint8_t* entry = (uint8_t*) heap + 1 + (1 << 16);
+    while (memcmp (entry, entries, sizeof (entries)) != 0) {
+    	entry ++;
+    }
+    entry [2] = 12;
+    assert_int_equal (virtual_check (heap), 1);
+    assert_int_equal (virtual_detach (heap), 0);
+    assert_null (virtual_attach (PERSIST_PATH));
+    
+    // a file cut short
+    unlink (PERSIST_PATH);
+    heap = virtual_create (PERSIST_PATH, 16, 10, 0);
+    assert_int_equal (virtual_check (heap), 0);
+    assert_int_equal (virtual_detach (heap), 0);
+    assert_int_equal (truncate (PERSIST_PATH, 4096), 0);
+    assert_null (virtual_attach (PERSIST_PATH));
+    unlink (PERSIST_PATH);
+}
+
+static void test_persist_hints (void** state) {
+    unlink (PERSIST_PATH);
+    void* heap = virtual_create (PERSIST_PATH, 16, 10, VIRTUAL_LIFO);
+    assert_non_null (heap);
+    uint8_t* ptrs [4];
+    uint32_t i = 0;
+    for (i = 0; i < 4; i ++) {
+    	ptrs [i] = virtual_malloc (heap, 1024);
+    }
+    assert_int_equal (virtual_free (heap, ptrs [0]), 0);
+    assert_int_equal (virtual_free (heap, ptrs [2]), 0);
+    assert_int_equal (virtual_detach (heap), 0);
+    
+    // the blocks remembered before are forgotten, so the lowest is taken
+    heap = virtual_attach (PERSIST_PATH);
+    assert_non_null (heap);
+    uint8_t* data = virtual_data (heap);
+    assert_ptr_equal (virtual_malloc (heap, 1024), data);
+    assert_ptr_equal (virtual_malloc (heap, 1024), data + 2048);
+    assert_int_equal (virtual_free (heap, data + 3072), 0);
+    assert_int_equal (virtual_check (heap), 0);
+    assert_int_equal (virtual_detach (heap), 0);
+    unlink (PERSIST_PATH);
+}
+
+#define SHM_NAME "/virtual_alloc_test"
+
+static void test_shm_pass_block (void** state) {
+    virtual_shm_unlink (SHM_NAME);
+    void* heap = virtual_shm_create (SHM_NAME, 20, 8, 0);
+    assert_non_null (heap);
+    int fds [2];
+    assert_int_equal (pipe (fds), 0);
+    
+    pid_t pid = fork ();
+    if (pid == 0) {
+    	// the child maps the heap on its own, allocates and fills a block
+    	// and passes its offset
+    	void* child_heap = virtual_shm_attach (SHM_NAME);
+    	uint8_t* ptr = child_heap ? virtual_shm_malloc (child_heap, 5000) : NULL;
+    	if (ptr == NULL) {
+    		_exit (1);
+    	}
+    	memset (ptr, 9, 5000);
+    	uint64_t offset = virtual_shm_offset (child_heap, ptr);
+    	if (write (fds [1], &offset, sizeof (offset)) != sizeof (offset)) {
+    		_exit (1);
+    	}
+    	virtual_shm_detach (child_heap);
+    	_exit (0);
+    }
+    int status = 0;
+    assert_int_equal (waitpid (pid, &status, 0), pid);
+    assert_true (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+    uint64_t offset = 0;
+    assert_int_equal (read (fds [0], &offset, sizeof (offset)), sizeof (offset));
+    close (fds [0]);
+    close (fds [1]);
+    
+    uint8_t* ptr = virtual_shm_ptr (heap, offset);
+    assert_int_equal (ptr [0], 9);
+    assert_int_equal (ptr [4999], 9);
+    assert_int_equal (virtual_usable_size (heap, ptr), 8192);
+    assert_int_equal (virtual_shm_free (heap, ptr), 0);
+    // the block holding the lock cannot be freed
+    assert_int_equal (virtual_shm_free (heap, virtual_data (heap)), 1);
+    assert_int_equal (virtual_shm_detach (heap), 0);
+    assert_int_equal (virtual_shm_unlink (SHM_NAME), 0);
+    assert_null (virtual_shm_attach (SHM_NAME));
+}
+
+static void test_shm_concurrent (void** state) {
+    virtual_shm_unlink (SHM_NAME);
+    void* heap = virtual_shm_create (SHM_NAME, 20, 6, 0);
+    assert_non_null (heap);
+    struct virtual_stats before;
+    virtual_stats (heap, &before);
+    
+    pid_t pids [4];
+    int i = 0;
+    for (i = 0; i < 4; i ++) {
+    	pids [i] = fork ();
+    	if (pids [i] == 0) {
+    		void* child_heap = virtual_shm_attach (SHM_NAME);
+    		if (child_heap == NULL) {
+    			_exit (1);
+    		}
+    		uint8_t* ptrs [16] = {NULL};
+    		uint32_t seed = i + 1;
+    		int n = 0;
+    		for (n = 0; n < 40000; n ++) {
+    			seed = seed * 1103515245 + 12345;
+    			int slot = (seed >> 16) % 16;
+    			if (ptrs [slot] != NULL) {
+    				if (ptrs [slot][0] != i ||
+    				    virtual_shm_free (child_heap, ptrs [slot]) != 0) {
+    					_exit (1);
+    				}
+    				ptrs [slot] = NULL;
+    			} else {
+    				ptrs [slot] = virtual_shm_malloc (child_heap,
+    								  1 + (seed >> 8) % 3000);
+    				if (ptrs [slot] != NULL) {
+    					ptrs [slot][0] = i;
+    				}
+    			}
+    		}
+    		for (n = 0; n < 16; n ++) {
+    			if (ptrs [n] != NULL) {
+    				virtual_shm_free (child_heap, ptrs [n]);
+    			}
+    		}
+    		virtual_shm_detach (child_heap);
+    		_exit (0);
+    	}
+    }
+    for (i = 0; i < 4; i ++) {
+    	int status = 0;
+    	assert_int_equal (waitpid (pids [i], &status, 0), pids [i]);
+    	assert_true (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+    }
+    // every block was freed again, and the heap is whole
+    struct virtual_stats after;
+    virtual_stats (heap, &after);
+    assert_memory_equal (&before, &after, sizeof (before));
+    assert_int_equal (virtual_check (heap), 0);
+    assert_int_equal (virtual_shm_detach (heap), 0);
+    assert_int_equal (virtual_shm_unlink (SHM_NAME), 0);
+}
+
+static void test_scan_long_array (void** state) {
+    init_allocator (heap_start, 16, 6);
+    void* start = program_break;
+    uint8_t* data = virtual_data (heap_start);
+    uint8_t* ptrs [1024];
+    uint32_t i = 0;
+    // 1024 blocks of 64 bytes, so our data structure is 1026 bytes long
+    for (i = 0; i < 1024; i ++) {
+    	ptrs [i] = virtual_malloc (heap_start, 64);
+    	assert_ptr_equal (ptrs [i], data + 64 * i);
+    }
+    assert_ptr_equal (program_break, start + 1023);
+    // freeing every other block from the top leaves the free blocks far
+    // from the start, and the entries long to move
+    for (i = 1024; i > 0; i -= 2) {
+    	assert_int_equal (virtual_free (heap_start, ptrs [i - 1]), 0);
+    }
+    for (i = 1; i < 1024; i += 2) {
+    	ptrs [i] = virtual_malloc (heap_start, 64);
+    	assert_ptr_equal (ptrs [i], data + 64 * i);
+    }
+    // freeing the lower half merges it into one block, and the next
+    // 128 byte block is the first of it
+    for (i = 0; i < 512; i ++) {
+    	assert_int_equal (virtual_free (heap_start, ptrs [i]), 0);
+    }
+    assert_ptr_equal (program_break, start + 512);
+    assert_ptr_equal (virtual_malloc (heap_start, 128), data);
+    assert_ptr_equal (virtual_malloc (heap_start, 4096), data + 4096);
+    struct virtual_stats stats;
+    virtual_stats (heap_start, &stats);
+    assert_int_equal (stats.allocated_bytes, 32768 + 128 + 4096);
+}
+
+static void test_free_orders (void** state) {
+    init_allocator (heap_start, 16, 6);
+    uint8_t* data = virtual_data (heap_start);
+    uint8_t* ptrs [1024];
+    uint32_t i = 0;
+    for (i = 0; i < 1024; i ++) {
+    	ptrs [i] = virtual_malloc (heap_start, 64);
+    }
+    // only blocks of 64 bytes are free, so larger requests fail
+    for (i = 0; i < 1024; i += 2) {
+    	assert_int_equal (virtual_free (heap_start, ptrs [i]), 0);
+    }
+    assert_int_equal (virtual_check (heap_start), 0);
+    assert_null (virtual_malloc (heap_start, 65));
+    assert_null (virtual_malloc (heap_start, 1 << 16));
+    
+    // a free 256 byte block at the start, and a 128 byte one at the end
+    for (i = 1; i < 4; i += 2) {
+    	assert_int_equal (virtual_free (heap_start, ptrs [i]), 0);
+    }
+    assert_int_equal (virtual_free (heap_start, ptrs [1023]), 0);
+    assert_int_equal (virtual_check (heap_start), 0);
+    // the smallest order that fits is used, not the leftmost block
+    assert_ptr_equal (virtual_malloc (heap_start, 100), data + 64 * 1022);
+    // and larger orders are split down to the request
+    assert_ptr_equal (virtual_malloc (heap_start, 100), data);
+    assert_ptr_equal (virtual_malloc (heap_start, 100), data + 128);
+    assert_null (virtual_malloc (heap_start, 100));
+    assert_int_equal (virtual_check (heap_start), 0);
+}
+
+static void test_lazy_coalesce (void** state) {
+    init_allocator_ex (heap_start, 16, 6, VIRTUAL_LAZY);
+    void* start = program_break;
+    uint8_t* data = virtual_data (heap_start);
+    struct virtual_stats stats;
+    uint8_t* ptrs [64] = {NULL};
+    uint32_t i = 0;
+    for (i = 0; i < 8; i ++) {
+    	ptrs [i] = virtual_malloc (heap_start, 64);
+    }
+    assert_ptr_equal (program_break, start + 14);
+    // freed buddies stay apart, and are used again without a split
+    assert_int_equal (virtual_free (heap_start, ptrs [0]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [1]), 0);
+    assert_ptr_equal (program_break, start + 14);
+    assert_ptr_equal (virtual_malloc (heap_start, 64), data);
+    assert_ptr_equal (virtual_malloc (heap_start, 64), data + 64);
+    
+    // taking the block at 0 took it away from its free buddy, so the
+    // third block freed next to its free buddy, the one at 320, is one
+    // too many, and all of them merge.
+    assert_int_equal (virtual_set_watermark (heap_start, 6, 2), 0);
+    assert_int_equal (virtual_set_watermark (heap_start, 17, 2), 1);
+    for (i = 0; i < 6; i ++) {
+    	assert_int_equal (virtual_free (heap_start, ptrs [i]), 0);
+    }
+    virtual_stats (heap_start, &stats);
+    assert_int_equal (stats.free_blocks, 9);
+    assert_int_equal (stats.largest_free, 1 << 15);
+    assert_ptr_equal (program_break, start + 10);
+    assert_int_equal (virtual_check (heap_start), 0);
+    
+    // an allocation nothing is large enough for merges the rest
+    assert_int_equal (virtual_set_watermark (heap_start, 6, 100), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [6]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [7]), 0);
+    assert_ptr_equal (virtual_malloc (heap_start, 1 << 16), data);
+    assert_ptr_equal (program_break, start);
+    assert_int_equal (virtual_free (heap_start, data), 0);
+    
+    // random sizes, with our data structure checked after every call
+    memset (ptrs, 0, sizeof (ptrs));
+    uint32_t seed = 1;
+    for (i = 0; i < 20000; i ++) {
+    	seed = seed * 1103515245 + 12345;
+    	uint32_t slot = (seed >> 16) % 64;
+    	if (ptrs [slot] != NULL) {
+    		assert_int_equal (virtual_free (heap_start, ptrs [slot]), 0);
+    		ptrs [slot] = NULL;
+    	} else {
+    		ptrs [slot] = virtual_malloc (heap_start, 1 + (seed >> 8) % 2000);
+    	}
+    	assert_int_equal (virtual_check (heap_start), 0);
+    }
+    for (i = 0; i < 64; i ++) {
+    	if (ptrs [i] != NULL) {
+    		assert_int_equal (virtual_free (heap_start, ptrs [i]), 0);
+    	}
+    }
+    virtual_coalesce (heap_start);
+    assert_int_equal (virtual_coalesce (heap_start), 0);
+    virtual_stats (heap_start, &stats);
+    assert_int_equal (stats.largest_free, 1 << 16);
+    assert_ptr_equal (program_break, start);
+    
+    // growing in place into free blocks that were left unmerged
+    for (i = 0; i < 4; i ++) {
+    	ptrs [i] = virtual_malloc (heap_start, 64);
+    }
+    assert_int_equal (virtual_free (heap_start, ptrs [2]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [3]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [1]), 0);
+    assert_int_equal (virtual_try_expand (heap_start, ptrs [0], 256), 256);
+    assert_int_equal (virtual_usable_size (heap_start, ptrs [0]), 256);
+    assert_int_equal (virtual_check (heap_start), 0);
+}
+
+static void test_lifo_policy (void** state) {
+    uint8_t* data = NULL;
+    uint8_t* ptrs [4];
+    uint32_t flags [2] = {0, VIRTUAL_LIFO};
+    uint32_t f = 0;
+    uint32_t i = 0;
+    for (f = 0; f < 2; f ++) {
+    	init_allocator_ex (heap_start, 16, 6, flags [f]);
+    	data = virtual_data (heap_start);
+    	for (i = 0; i < 4; i ++) {
+    		ptrs [i] = virtual_malloc (heap_start, 64);
+    	}
+    	// neither has a free buddy, so both stay 64 bytes
+    	assert_int_equal (virtual_free (heap_start, ptrs [0]), 0);
+    	assert_int_equal (virtual_free (heap_start, ptrs [2]), 0);
+    	if (flags [f] == 0) {
+    		// the lowest address first
+    		assert_ptr_equal (virtual_malloc (heap_start, 64), data);
+    		assert_ptr_equal (virtual_malloc (heap_start, 64), data + 128);
+    	} else {
+    		// the block freed last first
+    		assert_ptr_equal (virtual_malloc (heap_start, 64), data + 128);
+    		assert_ptr_equal (virtual_malloc (heap_start, 64), data);
+    	}
+    }
+    
+    // the block at 128 merged after it was freed, so it is skipped as
+    // a 64 byte block, and taken as a 128 byte one
+    assert_int_equal (virtual_free (heap_start, ptrs [0]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [2]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [3]), 0);
+    assert_ptr_equal (virtual_malloc (heap_start, 64), data);
+    assert_ptr_equal (virtual_malloc (heap_start, 64), data + 128);
+    // nothing remembered is left, so the leftmost blocks are used
+    assert_ptr_equal (virtual_malloc (heap_start, 64), data + 192);
+    assert_ptr_equal (virtual_malloc (heap_start, 128), data + 256);
+    assert_int_equal (virtual_check (heap_start), 0);
+}
+
+static void test_hot_cold (void** state) {
+    init_allocator (heap_start, 16, 6);
+    uint8_t* data = virtual_data (heap_start);
+    struct virtual_stats stats;
+    // short lived blocks are taken from the top of the heap, and long
+    // lived ones from the bottom, whatever the size of the free block
+    uint8_t* s1 = virtual_malloc_ex (heap_start, 64, VIRTUAL_SHORT_LIVED, NULL);
+    assert_ptr_equal (s1, data + 65536 - 64);
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 64, VIRTUAL_LONG_LIVED, NULL), data);
+    // without a hint, the smallest block that fits
+    assert_ptr_equal (virtual_malloc (heap_start, 64), data + 64);
+    uint8_t* s2 = virtual_malloc_ex (heap_start, 64, VIRTUAL_SHORT_LIVED, NULL);
+    assert_ptr_equal (s2, data + 65536 - 128);
+    // the rightmost 1024 byte block, not the one at 1024
+    uint8_t* s3 = virtual_malloc_ex (heap_start, 1000, VIRTUAL_SHORT_LIVED, NULL);
+    assert_ptr_equal (s3, data + 65536 - 2048);
+    assert_int_equal (virtual_check (heap_start), 0);
+    
+    // once they are freed, the top half is whole again
+    assert_int_equal (virtual_free (heap_start, s2), 0);
+    assert_int_equal (virtual_free (heap_start, s1), 0);
+    assert_int_equal (virtual_free (heap_start, s3), 0);
+    virtual_stats (heap_start, &stats);
+    assert_int_equal (stats.allocated_blocks, 2);
+    assert_int_equal (stats.largest_free, 1 << 15);
+    
+    // the hints override VIRTUAL_LIFO
+    init_allocator_ex (heap_start, 16, 6, VIRTUAL_LIFO);
+    data = virtual_data (heap_start);
+    uint8_t* ptrs [4];
+    uint32_t i = 0;
+    for (i = 0; i < 4; i ++) {
+    	ptrs [i] = virtual_malloc (heap_start, 64);
+    }
+    assert_int_equal (virtual_free (heap_start, ptrs [0]), 0);
+    assert_int_equal (virtual_free (heap_start, ptrs [2]), 0);
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 64, VIRTUAL_LONG_LIVED, NULL), data);
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 64, VIRTUAL_SHORT_LIVED, NULL),
+    		      data + 65536 - 64);
+    assert_int_equal (virtual_check (heap_start), 0);
+}
+
+static void test_malloc_flags (void** state) {
+    init_allocator (heap_start, 16, 6);
+    uint8_t* data = virtual_data (heap_start);
+    uint64_t usable = 0;
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 100, 0, &usable), data);
+    assert_int_equal (usable, 128);
+    // the buddy of the first block is the only one of its size
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 100, VIRTUAL_EXACT_ORDER,
+    					&usable), data + 128);
+    assert_null (virtual_malloc_ex (heap_start, 100, VIRTUAL_EXACT_ORDER,
+    				    &usable));
+    assert_int_equal (usable, 0);
+    
+    // splitting the 256 byte block is allowed, the 2048 byte one is not
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 100,
+    					VIRTUAL_NO_SPLIT_ABOVE_ORDER (8), &usable),
+    		      data + 256);
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 1000,
+    					VIRTUAL_NO_SPLIT_ABOVE_ORDER (8), &usable),
+    		      data + 1024);
+    assert_int_equal (usable, 1024);
+    assert_null (virtual_malloc_ex (heap_start, 1000,
+    				    VIRTUAL_NO_SPLIT_ABOVE_ORDER (10), NULL));
+    
+    // a split would move the program break
+    uint64_t before = current_size;
+    assert_null (virtual_malloc_ex (heap_start, 64, VIRTUAL_NO_GROW, NULL));
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 128, VIRTUAL_NO_GROW, NULL),
+    		      data + 384);
+    assert_int_equal (current_size, before);
+    
+    // the whole block is cleared, not only the size asked for
+    uint8_t* ptr = virtual_malloc (heap_start, 200);
+    memset (ptr, 0xff, 256);
+    assert_int_equal (virtual_free (heap_start, ptr), 0);
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 200, VIRTUAL_ZERO, &usable),
+    		      ptr);
+    uint32_t i = 0;
+    for (i = 0; i < usable; i ++) {
+    	assert_int_equal (ptr [i], 0);
+    }
+    assert_int_equal (virtual_check (heap_start), 0);
+    
+    // reserved heaps never grow, so they can split
+    init_allocator_ex (heap_start, 12, 6, VIRTUAL_RESERVED);
+    assert_ptr_equal (virtual_malloc_ex (heap_start, 64, VIRTUAL_NO_GROW, NULL),
+    		      virtual_data (heap_start));
+    assert_int_equal (virtual_check (heap_start), 0);
+}
+
+static void test_huge_pages (void** state) {
+    void* heap = virtual_huge_create (23, 12, 0);
+    assert_non_null (heap);
+    uint8_t* data = virtual_data (heap);
+    assert_int_equal ((uintptr_t) data % (1 << VIRTUAL_HUGE_ORDER), 0);
+    struct virtual_stats stats;
+    
+    // huge blocks are packed at the bottom, small ones at the top
+    uint8_t* big = virtual_huge_malloc (heap, 3 << 20);
+    assert_ptr_equal (big, data);
+    uint8_t* small = virtual_huge_malloc (heap, 100);
+    assert_ptr_equal (small, data + (1 << 23) - 4096);
+    uint8_t* big2 = virtual_huge_malloc (heap, 2 << 20);
+    assert_ptr_equal (big2, data + (4 << 20));
+    memset (big, 1, 3 << 20);
+    memset (small, 2, 100);
+    memset (big2, 3, 2 << 20);
+    assert_int_equal (big [(3 << 20) - 1] + small [99] + big2 [0], 6);
+    
+    assert_int_equal (virtual_huge_free (heap, big + 1), 1);
+    assert_int_equal (virtual_huge_free (heap, big), 0);
+    assert_int_equal (virtual_huge_free (heap, small), 0);
+    assert_int_equal (virtual_huge_free (heap, big2), 0);
+    virtual_stats (heap, &stats);
+    assert_int_equal (stats.largest_free, 1 << 23);
+    assert_int_equal (virtual_check (heap), 0);
+    assert_int_equal (virtual_huge_destroy (heap), 0);
+}
+
+static void test_malloc_order (void** state) {
+    init_allocator (heap_start, 16, 6);
+    uint8_t* data = virtual_data (heap_start);
+    // only orders from the minimum to the initial size
+    assert_null (virtual_malloc_order (heap_start, 5));
+    assert_null (virtual_malloc_order (heap_start, 17));
+    assert_ptr_equal (virtual_malloc_order (heap_start, 6), data);
+    uint8_t* ptr = virtual_malloc_order (heap_start, 12);
+    assert_ptr_equal (ptr, data + 4096);
+    assert_int_equal (virtual_usable_size (heap_start, ptr), 4096);
+    
+    // the order has to match the block
+    assert_int_equal (virtual_free_order (heap_start, ptr, 11), 1);
+    assert_int_equal (virtual_free_order (heap_start, ptr + 64, 6), 1);
+    assert_int_equal (virtual_free_order (heap_start, ptr, 12), 0);
+    assert_int_equal (virtual_free_order (heap_start, data, 6), 0);
+    struct virtual_stats stats;
+    virtual_stats (heap_start, &stats);
+    assert_int_equal (stats.largest_free, 1 << 16);
+}
+
 int main() {
     // Your own testing code here
     const struct CMUnitTest tests [] = {
@@ -635,7 +1675,41 @@ int main() {
    	cmocka_unit_test_setup_teardown (test_realloc_minimum_one, initialise, reset),
    	cmocka_unit_test_setup_teardown (test_realloc_minimum_initial_size, initialise, reset),
    	cmocka_unit_test_setup_teardown (test_integrated, initialise, reset),
-   	cmocka_unit_test_setup_teardown (test_integrated_long, initialise, reset)
+   	cmocka_unit_test_setup_teardown (test_integrated_long, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_trace_record, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_free_beyond_initial_size, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_free_not_buddies, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_realloc_restores_block, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_aligned_layout, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_aligned_alloc, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_calloc_dirty, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_calloc_known_zero, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_usable_size, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_free_sized, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_try_expand, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_try_shrink, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_region_alloc, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_region_reset, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_pool_get_put, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_pool_slabs, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_relocate, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_handle_pin, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_handle_compact, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_defrag_step, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_defrag_refused, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_persist_attach, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_persist_damaged, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_persist_hints, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_shm_pass_block, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_shm_concurrent, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_scan_long_array, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_free_orders, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_lazy_coalesce, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_lifo_policy, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_hot_cold, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_malloc_flags, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_huge_pages, initialise, reset),
+   	cmocka_unit_test_setup_teardown (test_malloc_order, initialise, reset)
    	
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
@@ -0,0 +1,265 @@
+#include "virtual_alloc.h"
+#include "virtual_sbrk.h"
+#include "virtual_resource.hpp"
+#include "virtual_buddy_heap.hpp"
+#include "virtual_allocator.hpp"
+#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+extern "C" {
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include "cmocka.h"
+}
+
+/*Tests of the C++ interfaces over the allocator. The heap is set up like
+in tests.c. Details about all the tests are mentioned in testinfo.txt*/
+
+static void * virtual_heap;
+static char * program_break;
+static uint64_t current_size;
+static const uint64_t size = 10000000;
+
+extern "C" void * virtual_sbrk (int32_t increment) {
+    if ((current_size + increment) >= size) {
+    	return (void *)(-1);
+    }
+    void* temp = program_break;
+    program_break += increment;
+    current_size += increment;
+    return temp;
+}
+
+static int initialise (void** state) {
+    virtual_heap = malloc (size);
+    program_break = (char*) virtual_heap;
+    current_size = 0;
+    return 0;
+}
+
+static int reset (void** state) {
+    free (virtual_heap);
+    return 0;
+}
+
+static void test_resource_vector (void** state) {
+    init_allocator_ex (virtual_heap, 20, 6, VIRTUAL_ALIGNED);
+    virtual_alloc::buddy_memory_resource resource (virtual_heap);
+    struct virtual_stats stats;
+    {
+    	std::pmr::vector<uint64_t> v (&resource);
+    	for (uint64_t i = 0; i < 10000; i ++) {
+    		v.push_back (i);
+    	}
+    	assert_int_equal (v [9999], 9999);
+    	virtual_stats (virtual_heap, &stats);
+    	assert_int_equal (stats.allocated_blocks, 1);
+    	assert_true (stats.allocated_bytes >= 80000);
+
+    	std::pmr::unordered_map<uint32_t, std::pmr::string> map (&resource);
+    	for (uint32_t i = 0; i < 500; i ++) {
+    		map.emplace (i, std::pmr::string (100, 'a' + i % 26, &resource));
+    	}
+    	assert_int_equal (map.at (27) [99], 'b');
+    	// every node is aligned for its type
+    	for (auto& entry : map) {
+    		assert_int_equal ((uintptr_t) &entry % alignof (decltype (entry)), 0);
+    	}
+    }
+    // everything went back to the heap, through the sized free
+    virtual_stats (virtual_heap, &stats);
+    assert_int_equal (stats.allocated_blocks, 0);
+    assert_int_equal (stats.largest_free, 1 << 20);
+}
+
+static void test_resource_equal (void** state) {
+    init_allocator_ex (virtual_heap, 16, 6, VIRTUAL_ALIGNED);
+    virtual_alloc::buddy_memory_resource resource (virtual_heap);
+    virtual_alloc::buddy_memory_resource same (virtual_heap);
+    char* other_heap = (char*) virtual_heap + (1 << 21);
+    init_allocator_ex (other_heap, 12, 6, VIRTUAL_ALIGNED | VIRTUAL_RESERVED);
+    virtual_alloc::buddy_memory_resource other (other_heap);
+    assert_true (resource == same);
+    assert_false (resource == other);
+    assert_false (resource == *std::pmr::new_delete_resource ());
+
+    // a page aligned block
+    void* ptr = resource.allocate (100, 4096);
+    assert_int_equal ((uintptr_t) ptr % 4096, 0);
+    resource.deallocate (ptr, 100, 4096);
+    bool thrown = false;
+    try {
+    	ptr = resource.allocate (1 << 17);
+    } catch (const std::bad_alloc&) {
+    	thrown = true;
+    }
+    assert_true (thrown);
+    struct virtual_stats stats;
+    virtual_stats (virtual_heap, &stats);
+    assert_int_equal (stats.allocated_blocks, 0);
+}
+
+static void test_resource_unaligned_heap (void** state) {
+    // the data region starts right after the size byte
+    init_allocator (virtual_heap, 16, 6);
+    bool thrown = false;
+    try {
+    	virtual_alloc::buddy_memory_resource resource (virtual_heap);
+    } catch (const std::invalid_argument&) {
+    	thrown = true;
+    }
+    assert_true (thrown);
+    struct virtual_stats stats;
+    virtual_stats (virtual_heap, &stats);
+    assert_int_equal (stats.allocated_blocks, 0);
+}
+
+typedef virtual_alloc::BuddyHeap<16, 8> SmallHeap;
+static_assert (SmallHeap::order_of (1) == 8, "");
+static_assert (SmallHeap::order_of (3000) == 12, "");
+static_assert (SmallHeap::order_of (4097) == 13, "");
+static_assert (!SmallHeap::fits (0) && !SmallHeap::fits (1 << 17), "");
+
+static void test_buddy_heap (void** state) {
+    // two heaps side by side in the same memory, without virtual_sbrk
+    char* memory = (char*) virtual_heap;
+    uint64_t first_size = SmallHeap::reserve_size (memory);
+    assert_true (first_size > SmallHeap::heap_size);
+    assert_true (first_size < SmallHeap::heap_size + 2000);
+    SmallHeap first (memory);
+    virtual_alloc::BuddyHeap<12, 6, VIRTUAL_ALIGNED> second (memory + first_size);
+    assert_ptr_equal (program_break, virtual_heap);
+    
+    void* ptr = first.allocate<3000> ();
+    assert_non_null (ptr);
+    assert_true (first.contains (ptr));
+    assert_false (second.contains (ptr));
+    assert_int_equal (virtual_usable_size (first.heapstart (), ptr), 4096);
+    assert_int_equal (first.offset (ptr) % 4096, 0);
+    assert_ptr_equal (first.at (first.offset (ptr)), ptr);
+    
+    void* ptr2 = second.allocate (100);
+    assert_int_equal ((uintptr_t) ptr2 % 128, 0);
+    // the sized free checks the size
+    assert_int_equal (first.deallocate<100> (ptr), 1);
+    assert_int_equal (first.deallocate<3000> (ptr), 0);
+    assert_int_equal (second.deallocate (ptr2, 100), 0);
+    
+    struct virtual_stats stats;
+    virtual_stats (first.heapstart (), &stats);
+    assert_int_equal (stats.largest_free, SmallHeap::heap_size);
+    virtual_stats (second.heapstart (), &stats);
+    assert_int_equal (stats.largest_free, 4096);
+}
+
+static void test_allocator_containers (void** state) {
+    init_allocator_ex (virtual_heap, 20, 6, VIRTUAL_ALIGNED);
+    typedef virtual_alloc::BuddyAllocator<int> IntAllocator;
+    IntAllocator alloc (virtual_heap);
+    struct virtual_stats stats;
+    {
+    	std::vector<int, IntAllocator> v (alloc);
+    	for (int i = 0; i < 1000; i ++) {
+    		v.push_back (i);
+    	}
+    	// nodes are rebound to the node type, and share the heap
+    	typedef std::pair<const int, double> Node;
+    	std::map<int, double, std::less<int>,
+    		 virtual_alloc::BuddyAllocator<Node> > m (alloc);
+    	for (int i = 0; i < 100; i ++) {
+    		m [i] = i * 0.5;
+    	}
+    	assert_true (m.get_allocator () == alloc);
+    	assert_int_equal (v [999] + (int) m [99], 999 + 49);
+    	virtual_stats (virtual_heap, &stats);
+    	assert_int_equal (stats.allocated_blocks, 101);
+    	
+    	// the heap goes along with a swap
+    	char* other_heap = (char*) virtual_heap + (1 << 21);
+    	init_allocator_ex (other_heap, 12, 6, VIRTUAL_ALIGNED | VIRTUAL_RESERVED);
+    	IntAllocator other_alloc (other_heap);
+    	std::vector<int, IntAllocator> w (other_alloc);
+    	w.push_back (1);
+    	v.swap (w);
+    	assert_ptr_equal (v.get_allocator ().heapstart (), other_heap);
+    	assert_ptr_equal (w.get_allocator ().heapstart (), virtual_heap);
+    	assert_true (v.get_allocator () != w.get_allocator ());
+    }
+    virtual_stats (virtual_heap, &stats);
+    assert_int_equal (stats.allocated_blocks, 0);
+}
+
+static void test_allocator_at_least (void** state) {
+    init_allocator_ex (virtual_heap, 16, 6, VIRTUAL_ALIGNED);
+    virtual_alloc::BuddyAllocator<uint64_t> alloc (virtual_heap);
+    // 100 elements take 800 bytes, so the block holds 128
+    auto result = alloc.allocate_at_least (100);
+    assert_int_equal (result.count, 128);
+    assert_int_equal ((uintptr_t) result.ptr % alignof (uint64_t), 0);
+    result.ptr [127] = 1;
+    alloc.deallocate (result.ptr, result.count);
+    
+    uint64_t* ptr = alloc.allocate (3);
+    alloc.deallocate (ptr, 3);
+    bool thrown = false;
+    try {
+    	ptr = alloc.allocate (1 << 14);
+    } catch (const std::bad_alloc&) {
+    	thrown = true;
+    }
+    assert_true (thrown);
+    struct virtual_stats stats;
+    virtual_stats (virtual_heap, &stats);
+    assert_int_equal (stats.allocated_blocks, 0);
+}
+
+static void test_allocator_unaligned_heap (void** state) {
+    // the data region starts right after the size byte
+    init_allocator (virtual_heap, 16, 6);
+    assert_int_equal (virtual_is_aligned (virtual_heap), 0);
+    bool thrown = false;
+    try {
+    	virtual_alloc::BuddyAllocator<int> ints (virtual_heap);
+    } catch (const std::invalid_argument&) {
+    	thrown = true;
+    }
+    assert_true (thrown);
+    
+    // even bytes, as the allocator may be rebound to aligned types
+    thrown = false;
+    try {
+    	virtual_alloc::BuddyAllocator<char> chars (virtual_heap);
+    } catch (const std::invalid_argument&) {
+    	thrown = true;
+    }
+    assert_true (thrown);
+    
+    init_allocator_ex (virtual_heap, 16, 6, VIRTUAL_ALIGNED);
+    assert_int_equal (virtual_is_aligned (virtual_heap), 1);
+    virtual_alloc::BuddyAllocator<char> chars (virtual_heap);
+    virtual_alloc::BuddyAllocator<int> ints (chars);
+    int* ptr = ints.allocate (100);
+    assert_int_equal ((uintptr_t) ptr % alignof (int), 0);
+    ints.deallocate (ptr, 100);
+    struct virtual_stats stats;
+    virtual_stats (virtual_heap, &stats);
+    assert_int_equal (stats.allocated_blocks, 0);
+}
+
+int main() {
+    const struct CMUnitTest tests [] = {
+    	cmocka_unit_test_setup_teardown (test_resource_vector, initialise, reset),
+    	cmocka_unit_test_setup_teardown (test_resource_equal, initialise, reset),
+    	cmocka_unit_test_setup_teardown (test_resource_unaligned_heap, initialise, reset),
+    	cmocka_unit_test_setup_teardown (test_buddy_heap, initialise, reset),
+    	cmocka_unit_test_setup_teardown (test_allocator_containers, initialise, reset),
+    	cmocka_unit_test_setup_teardown (test_allocator_at_least, initialise, reset),
+    	cmocka_unit_test_setup_teardown (test_allocator_unaligned_heap, initialise, reset)
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -1,10 +1,371 @@
 #include "virtual_alloc.h"
 #include "virtual_sbrk.h"
+#include "virtual_trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined (__x86_64__)
+#include <immintrin.h>
+#endif
 #define END_INDEX 255
 #define ALLOC 70
+#define LAYOUT_ALIGNED 0x80
+#define ORDER_MASK 0x3f
+#define PAGE_SIZE 4096
+#define LAZY_WATERMARK 8
+#define RECENT_SLOTS 16
+#define RECENT_NONE 0xff
+
+// trace recorder state, only used between virtual_trace_start and
+// virtual_trace_stop.
+static FILE *trace_file = NULL;
+static void *trace_heap = NULL;
+
+/*
+The first byte of the heap stores initial_size in its low bits, and the
+LAYOUT_ALIGNED flag in its high bit. The data region starts right after
+this byte, or, in the aligned layout, at the next PAGE_SIZE boundary.
+It is followed by the control block, aligned to 8 bytes, which holds
+the per heap state, and then by our data structure.
+*/
+struct heap_ctrl {
+    // bytes of the data region from this offset on were never handed
+    // out, and are zero if the heap memory was zero to begin with.
+    uint64_t zero_mark;
+    // index and offset of the block last allocated or freed, where the
+    // search for the next block to free starts.
+    uint64_t hint_index;
+    uint64_t hint_offset;
+    // the owner of the movable blocks, for virtual_defrag_step.
+    virtual_mover mover;
+    void *mover_ctx;
+    // the number of free blocks of every order, and a bit for every
+    // order that has any, so malloc finds the smallest order that can
+    // serve it without looking at our data structure.
+    uint64_t free_orders;
+    uint64_t free_count [64];
+    // with VIRTUAL_LAZY, the number of blocks of every order freed next
+    // to their free buddy without merging, and how many are allowed
+    // before every free buddy in the heap is merged.
+    uint32_t deferred [64];
+    uint32_t watermark [64];
+    // with VIRTUAL_LIFO, the order and offset of the last RECENT_SLOTS
+    // blocks freed, the newest at recent_top - 1, for the allocations
+    // of their size to take first.
+    uint64_t recent_offset [RECENT_SLOTS];
+    uint8_t recent_order [RECENT_SLOTS];
+    uint32_t recent_top;
+    uint32_t flags;
+};
+
+static inline uint8_t heap_order (void * heapstart) {
+    return *(uint8_t *) heapstart & ORDER_MASK;
+}
+
+static inline uint8_t * heap_data (void * heapstart) {
+    uintptr_t start = (uintptr_t) heapstart + 1;
+    if (*(uint8_t *) heapstart & LAYOUT_ALIGNED) {
+    	start = (start + PAGE_SIZE - 1) & ~(uintptr_t) (PAGE_SIZE - 1);
+    }
+    return (uint8_t *) start;
+}
+
+static inline struct heap_ctrl * heap_ctrl (void * heapstart) {
+    uintptr_t end = (uintptr_t) heap_data (heapstart) +
+    		    ((uint64_t) 1 << heap_order (heapstart));
+    return (struct heap_ctrl *) ((end + 7) & ~(uintptr_t) 7);
+}
+
+static inline uint8_t * heap_buddy (void * heapstart) {
+    return (uint8_t *) (heap_ctrl (heapstart) + 1);
+}
+
+static inline void order_add (struct heap_ctrl * ctrl, uint32_t order) {
+    if (ctrl->free_count [order] ++ == 0) {
+    	ctrl->free_orders |= (uint64_t) 1 << order;
+    }
+}
+
+static inline void order_remove (struct heap_ctrl * ctrl, uint32_t order) {
+    if (-- ctrl->free_count [order] == 0) {
+    	ctrl->free_orders &= ~((uint64_t) 1 << order);
+    }
+}
+
+// marks the free block at index allocated, keeping the counts.
+static inline void mark_allocated (struct heap_ctrl * ctrl, uint8_t * buddy,
+				   uint64_t index) {
+    order_remove (ctrl, buddy [index]);
+    buddy [index] += ALLOC;
+}
+
+// marks the allocated block at index free, keeping the counts.
+static inline void mark_free (struct heap_ctrl * ctrl, uint8_t * buddy,
+			      uint64_t index) {
+    buddy [index] -= ALLOC;
+    order_add (ctrl, buddy [index]);
+}
+
+/*
+Scanning our data structure. Free blocks of order j are the bytes equal
+to j, so finding the first one, the last one, or the end, is a byte
+search, and the
+offset of an entry is the sum of the sizes of the entries before it.
+Both are done 16 or 32 entries at a time with SSE2 or AVX2, picked at
+the first scan from what the CPU supports. VIRTUAL_ALLOC_SCAN=scalar,
+sse2 or avx2 in the environment picks a lower level, for testing.
+
+The byte search reads whole aligned vectors, which may reach past the
+end of our data structure, but never into another page.
+*/
+#define SCAN_UNKNOWN 0
+#define SCAN_SCALAR 1
+#define SCAN_SSE2 2
+#define SCAN_AVX2 3
+#define SCAN_SHORT 16
+
+static int scan_level = SCAN_UNKNOWN;
+
+static int scan_detect (void) {
+    int level = SCAN_SCALAR;
+#if defined (__x86_64__)
+    level = SCAN_SSE2;
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+    	level = SCAN_AVX2;
+    }
+#endif
+    const char *env = getenv ("VIRTUAL_ALLOC_SCAN");
+    if (env != NULL) {
+    	int wanted = level;
+    	if (strcmp (env, "scalar") == 0) {
+    		wanted = SCAN_SCALAR;
+    	} else if (strcmp (env, "sse2") == 0) {
+    		wanted = SCAN_SSE2;
+    	} else if (strcmp (env, "avx2") == 0) {
+    		wanted = SCAN_AVX2;
+    	}
+    	if (wanted < level) {
+    		level = wanted;
+    	}
+    }
+    return level;
+}
+
+static inline int scan_get_level (void) {
+    // every thread finds the same level, so racing here is harmless.
+    if (scan_level == SCAN_UNKNOWN) {
+    	scan_level = scan_detect ();
+    }
+    return scan_level;
+}
+
+#if defined (__x86_64__)
+__attribute__ ((no_sanitize_address))
+static uint64_t scan_find_sse2 (const uint8_t * buddy, uint64_t i,
+				uint8_t value) {
+    const uint8_t *p = buddy + i;
+    const uint8_t *chunk = (const uint8_t *) ((uintptr_t) p & ~(uintptr_t) 15);
+    __m128i want = _mm_set1_epi8 ((char) value);
+    __m128i end = _mm_set1_epi8 ((char) END_INDEX);
+    __m128i v = _mm_load_si128 ((const __m128i *) chunk);
+    uint32_t mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, want),
+    						    _mm_cmpeq_epi8 (v, end)));
+    // bytes before buddy + i are not looked at.
+    mask &= ~0u << (p - chunk);
+    while (mask == 0) {
+    	chunk += 16;
+    	v = _mm_load_si128 ((const __m128i *) chunk);
+    	mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, want),
+    						_mm_cmpeq_epi8 (v, end)));
+    }
+    return (chunk - buddy) + __builtin_ctz (mask);
+}
+
+__attribute__ ((target ("avx2"), no_sanitize_address))
+static uint64_t scan_find_avx2 (const uint8_t * buddy, uint64_t i,
+				uint8_t value) {
+    const uint8_t *p = buddy + i;
+    const uint8_t *chunk = (const uint8_t *) ((uintptr_t) p & ~(uintptr_t) 31);
+    __m256i want = _mm256_set1_epi8 ((char) value);
+    __m256i end = _mm256_set1_epi8 ((char) END_INDEX);
+    __m256i v = _mm256_load_si256 ((const __m256i *) chunk);
+    uint32_t mask = _mm256_movemask_epi8 (
+    	_mm256_or_si256 (_mm256_cmpeq_epi8 (v, want),
+    			 _mm256_cmpeq_epi8 (v, end)));
+    mask &= ~0u << (p - chunk);
+    while (mask == 0) {
+    	chunk += 32;
+    	v = _mm256_load_si256 ((const __m256i *) chunk);
+    	mask = _mm256_movemask_epi8 (
+    		_mm256_or_si256 (_mm256_cmpeq_epi8 (v, want),
+    				 _mm256_cmpeq_epi8 (v, end)));
+    }
+    return (chunk - buddy) + __builtin_ctz (mask);
+}
+
+// the last entry before i equal to value, going back to index 1.
+__attribute__ ((no_sanitize_address))
+static uint64_t scan_rfind_sse2 (const uint8_t * buddy, uint64_t i,
+				 uint8_t value) {
+    const uint8_t *first = buddy + 1;
+    const uint8_t *p = buddy + i;
+    const uint8_t *chunk = (const uint8_t *) ((uintptr_t) (p - 1) &
+    					      ~(uintptr_t) 15);
+    __m128i want = _mm_set1_epi8 ((char) value);
+    uint32_t mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (
+    		_mm_load_si128 ((const __m128i *) chunk), want));
+    // bytes from buddy + i on are not looked at.
+    mask &= (1u << (p - chunk)) - 1;
+    while (chunk > first && mask == 0) {
+    	chunk -= 16;
+    	mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (
+    		_mm_load_si128 ((const __m128i *) chunk), want));
+    }
+    // nor bytes before index 1, which holds the minimum size.
+    if (chunk < first) {
+    	mask &= ~0u << (first - chunk);
+    }
+    return (mask == 0) ? 0 : (chunk - buddy) + 31 - __builtin_clz (mask);
+}
+
+__attribute__ ((target ("avx2"), no_sanitize_address))
+static uint64_t scan_rfind_avx2 (const uint8_t * buddy, uint64_t i,
+				 uint8_t value) {
+    const uint8_t *first = buddy + 1;
+    const uint8_t *p = buddy + i;
+    const uint8_t *chunk = (const uint8_t *) ((uintptr_t) (p - 1) &
+    					      ~(uintptr_t) 31);
+    __m256i want = _mm256_set1_epi8 ((char) value);
+    uint32_t mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (
+    		_mm256_load_si256 ((const __m256i *) chunk), want));
+    mask &= (uint32_t) (((uint64_t) 1 << (p - chunk)) - 1);
+    while (chunk > first && mask == 0) {
+    	chunk -= 32;
+    	mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (
+    		_mm256_load_si256 ((const __m256i *) chunk), want));
+    }
+    if (chunk < first) {
+    	mask &= ~0u << (first - chunk);
+    }
+    return (mask == 0) ? 0 : (chunk - buddy) + 31 - __builtin_clz (mask);
+}
+
+// sums 2^order over 4 entries per step, for the entries from to to.
+__attribute__ ((target ("avx2")))
+static uint64_t scan_offset_avx2 (const uint8_t * buddy, uint64_t from,
+				  uint64_t to) {
+    __m256i sum = _mm256_setzero_si256 ();
+    __m256i one = _mm256_set1_epi64x (1);
+    __m256i alloc = _mm256_set1_epi64x (ALLOC);
+    __m256i below = _mm256_set1_epi64x (ALLOC - 1);
+    uint64_t i = from;
+    for (; i + 4 <= to; i += 4) {
+    	int32_t word;
+    	memcpy (&word, buddy + i, 4);
+    	__m256i v = _mm256_cvtepu8_epi64 (_mm_cvtsi32_si128 (word));
+    	// allocated entries are ALLOC + j.
+    	v = _mm256_sub_epi64 (v, _mm256_and_si256 (_mm256_cmpgt_epi64 (v, below),
+    						  alloc));
+    	sum = _mm256_add_epi64 (sum, _mm256_sllv_epi64 (one, v));
+    }
+    uint64_t lanes [4];
+    _mm256_storeu_si256 ((__m256i *) lanes, sum);
+    uint64_t total = lanes [0] + lanes [1] + lanes [2] + lanes [3];
+    for (; i < to; i ++) {
+    	uint32_t temp = buddy [i];
+    	total += (uint64_t) 1 << (temp >= ALLOC ? temp - ALLOC : temp);
+    }
+    return total;
+}
+#endif
+
+/*
+This function takes in our data structure, an index, and a value, and
+returns the index of the first entry from index on that is equal to the
+value, or is the end.
+*/
+static inline uint64_t scan_find (const uint8_t * buddy, uint64_t i,
+				  uint8_t value) {
+#if defined (__x86_64__)
+    // short scans are over before a vector scan would start.
+    uint64_t stop = i + SCAN_SHORT;
+    while (i < stop) {
+    	if (buddy [i] == value || buddy [i] == END_INDEX) {
+    		return i;
+    	}
+    	i += 1;
+    }
+    int level = scan_get_level ();
+    if (level == SCAN_AVX2) {
+    	return scan_find_avx2 (buddy, i, value);
+    }
+    if (level == SCAN_SSE2) {
+    	return scan_find_sse2 (buddy, i, value);
+    }
+#endif
+    while (buddy [i] != value && buddy [i] != END_INDEX) {
+    	i += 1;
+    }
+    return i;
+}
+
+/*
+This function takes in our data structure, an index, and a value, and
+returns the index of the last entry before index that is equal to the
+value, or 0 if there is none.
+*/
+static inline uint64_t scan_rfind (const uint8_t * buddy, uint64_t i,
+				   uint8_t value) {
+#if defined (__x86_64__)
+    uint64_t stop = (i > SCAN_SHORT + 1) ? i - SCAN_SHORT : 1;
+    while (i > stop) {
+    	i -= 1;
+    	if (buddy [i] == value) {
+    		return i;
+    	}
+    }
+    if (i <= 1) {
+    	return 0;
+    }
+    int level = scan_get_level ();
+    if (level == SCAN_AVX2) {
+    	return scan_rfind_avx2 (buddy, i, value);
+    }
+    if (level == SCAN_SSE2) {
+    	return scan_rfind_sse2 (buddy, i, value);
+    }
+#endif
+    while (i > 1) {
+    	i -= 1;
+    	if (buddy [i] == value) {
+    		return i;
+    	}
+    }
+    return 0;
+}
+
+/*
+This function takes in our data structure, and two indices, and returns
+the sum of the sizes of the blocks of the entries from from up to, but
+not including, to. Summed from 1, it is the offset of the entry at to.
+*/
+static inline uint64_t scan_offset (const uint8_t * buddy, uint64_t from,
+				    uint64_t to) {
+#if defined (__x86_64__)
+    if (to - from > SCAN_SHORT && scan_get_level () == SCAN_AVX2) {
+    	return scan_offset_avx2 (buddy, from, to);
+    }
+#endif
+    uint64_t total = 0;
+    uint64_t i = from;
+    for (i = from; i < to; i ++) {
+    	uint32_t temp = buddy [i];
+    	total += (uint64_t) 1 << (temp >= ALLOC ? temp - ALLOC : temp);
+    }
+    return total;
+}
 
 /*
 This function takes in the heapstart, and initial virtual heap
@@ -29,21 +390,91 @@ Value 255 in array denotes the end of array, and first index of array is
  void return type
 */
 void init_allocator (void * heapstart, uint8_t initial_size, uint8_t min_size) {
+    init_allocator_ex (heapstart, initial_size, min_size, 0);
+}
+
+/*
+This function initialises the virtual heap like init_allocator, with
+extra layout options.
+
+With VIRTUAL_ALIGNED, the data region starts at the first PAGE_SIZE
+aligned address after heapstart, instead of right after the size byte.
+As every block of size 2^j starts at a multiple of 2^j from the data
+region, every block is then aligned to min(2^j, PAGE_SIZE). This costs
+up to PAGE_SIZE extra bytes of virtual_sbrk.
+
+With VIRTUAL_ZEROED, the caller promises that the memory virtual_sbrk
+hands out is zero filled, so virtual_calloc can skip clearing the parts
+of the heap that were never allocated.
+
+With VIRTUAL_RESERVED, the caller already provides virtual_reserve_size
+bytes from heapstart on, and virtual_sbrk is never called for this heap.
+
+With VIRTUAL_LAZY, a freed block is not merged with its free buddy.
+It stays free at its size, for the next allocation of that size, until
+more than the watermark of its order were left that way, or an
+allocation finds no free block large enough; then virtual_coalesce
+merges every free buddy in the heap. The watermark of every order is
+LAZY_WATERMARK, and can be changed with virtual_set_watermark.
+
+Allocations take the leftmost free block of the smallest size that
+fits, which keeps the heap packed at low addresses. With VIRTUAL_LIFO,
+they take the block of that size freed last instead, while it is still
+free, as its memory is likely still in the cache.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+flags - VIRTUAL_ALIGNED, VIRTUAL_ZEROED, VIRTUAL_RESERVED, VIRTUAL_LAZY
+and VIRTUAL_LIFO, or 0 (uint32_t)
+
+return:
+void return type
+*/
+void init_allocator_ex (void * heapstart, uint8_t initial_size,
+			uint8_t min_size, uint32_t flags) {
 
     if (initial_size < min_size) {
        perror ("Initial size cannot be less than the minimum block size\n");
     	exit (0);
     }
     
-    uint64_t heap_length = 1 << initial_size;
-    void* success = virtual_sbrk ((1 << initial_size) + 4);
-    if (success == (void *)(-1)) {
-        perror("virtual sbrk failed!\n");
-    	exit(0);
-    }
     uint8_t *initial = (uint8_t *) heapstart;
     *initial = initial_size;
-    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
+    if (flags & VIRTUAL_ALIGNED) {
+    	*initial |= LAYOUT_ALIGNED;
+    }
+    uint8_t *buddy = heap_buddy (heapstart);
+    
+    // the size byte, any padding, the data region, the control block,
+    // and the first three entries of our data structure.
+    if ((flags & VIRTUAL_RESERVED) == 0) {
+    	void* success = virtual_sbrk ((buddy - initial) + 3);
+    	if (success == (void *)(-1)) {
+    	    perror("virtual sbrk failed!\n");
+    	    exit(0);
+    	}
+    }
+   
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    ctrl->flags = flags;
+    ctrl->zero_mark = (flags & VIRTUAL_ZEROED) ?
+    		      0 : (uint64_t) 1 << initial_size;
+    ctrl->hint_index = 1;
+    ctrl->hint_offset = 0;
+    ctrl->mover = NULL;
+    ctrl->mover_ctx = NULL;
+    memset (ctrl->free_count, 0, sizeof (ctrl->free_count));
+    ctrl->free_orders = 0;
+    order_add (ctrl, initial_size);
+    uint32_t j = 0;
+    for (j = 0; j < 64; j ++) {
+    	ctrl->deferred [j] = 0;
+    	ctrl->watermark [j] = LAZY_WATERMARK;
+    }
+    memset (ctrl->recent_order, RECENT_NONE, sizeof (ctrl->recent_order));
+    ctrl->recent_top = 0;
    
     buddy [0] = min_size;
     buddy [1] = initial_size;
@@ -51,452 +482,1833 @@ void init_allocator (void * heapstart, uint8_t initial_size, uint8_t min_size) {
 }
 
 /*
-This function takes in the heapstart, and index of the block to be split
-in our data structure as arguments, and splits the block into two buddies.
+This function takes in a would be heapstart, and the arguments of
+init_allocator_ex, and returns the most memory from heapstart on that
+such a heap ever uses: the data region and the control block, and our
+data structure when the heap is split into blocks of the minimum size.
+The heap memory is not touched.
+
+parameters:
+heapstart - the address where the heap would start (void*)
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+flags - the flags init_allocator_ex would get (uint32_t)
+
+return: (uint64_t) the number of bytes, or UINT64_MAX if our data
+structure could not be addressed.
+*/
+uint64_t virtual_reserve_size (void * heapstart, uint8_t initial_size,
+			       uint8_t min_size, uint32_t flags) {
+
+    if (initial_size < min_size || initial_size - min_size >= 48) {
+    	return UINT64_MAX;
+    }
+    uintptr_t data = (uintptr_t) heapstart + 1;
+    if (flags & VIRTUAL_ALIGNED) {
+    	data = (data + PAGE_SIZE - 1) & ~(uintptr_t) (PAGE_SIZE - 1);
+    }
+    uintptr_t ctrl = (data + ((uint64_t) 1 << initial_size) + 7) &
+    		     ~(uintptr_t) 7;
+    // the minimum size, one entry per block, and the end.
+    return (ctrl + sizeof (struct heap_ctrl)) - (uintptr_t) heapstart +
+    	   ((uint64_t) 1 << (initial_size - min_size)) + 2;
+}
+
+/*
+This function takes in the heapstart, and checks that our data structure
+describes the whole heap: every entry is a block between the minimum
+and the initial size, aligned to its size, the blocks add up to the
+heap size, and the end follows, and the count of free blocks of every
+order matches the entries. It is meant for heaps whose memory outlived
+the process that used them.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (int)
+on failure - it returns 1, if our data structure is damaged.
+on success - it returns 0.
+*/
+int virtual_check (void * heapstart) {
+
+    uint8_t initial_size = heap_order (heapstart);
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint8_t min_size = buddy [0];
+    uint64_t heap_size = (uint64_t) 1 << initial_size;
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint64_t free_count [64] = {0};
+    uint64_t sum = 0;
+    uint64_t i = 1;
+
+    if (initial_size < min_size || initial_size - min_size >= 48) {
+    	return 1;
+    }
+    while (sum < heap_size) {
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC && temp != END_INDEX) {
+    		temp -= ALLOC;
+    	} else if (temp < 64) {
+    		free_count [temp] += 1;
+    	}
+    	if (temp < min_size || temp > initial_size ||
+    	    (sum & (((uint64_t) 1 << temp) - 1)) != 0) {
+    		return 1;
+    	}
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
+    }
+    if (sum != heap_size || buddy [i] != END_INDEX) {
+    	return 1;
+    }
+    for (i = 0; i < 64; i ++) {
+    	if (free_count [i] != ctrl->free_count [i] ||
+    	    (free_count [i] != 0) != ((ctrl->free_orders >> i) & 1)) {
+    		return 1;
+    	}
+    }
+    return 0;
+}
+
+/*
+This function takes in the heapstart, and resets the state derived from
+our data structure: the search hint, the blocks remembered for
+VIRTUAL_LIFO, and the counts of blocks left unmerged. virtual_check does
+not look at them, and a process dying while it changed the heap can
+leave them out of step with the entries, so a heap taken over from
+another process is reset before it is used. Nothing is lost but speed.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: void return type
+*/
+void virtual_reset_hints (void * heapstart) {
+
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    ctrl->hint_index = 1;
+    ctrl->hint_offset = 0;
+    memset (ctrl->recent_order, RECENT_NONE, sizeof (ctrl->recent_order));
+    ctrl->recent_top = 0;
+    memset (ctrl->deferred, 0, sizeof (ctrl->deferred));
+}
+
+/*
+This function returns the start of the data region of the heap, which
+every block offset is relative to. Blocks of size 2^j start at multiples
+of 2^j from it.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (void*) the start of the data region
+*/
+void * virtual_data (void * heapstart) {
+    return heap_data (heapstart);
+}
+
+/*
+This function takes in the heapstart, and tells if the heap was
+initialised with VIRTUAL_ALIGNED, so its blocks of size 2^j are aligned
+to min(2^j, PAGE_SIZE).
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (int) 1 if the data region is PAGE_SIZE aligned, 0 otherwise.
+*/
+int virtual_is_aligned (void * heapstart) {
+    return (* (uint8_t *) heapstart & LAYOUT_ALIGNED) != 0;
+}
+
+/*
+This function takes in the control block of a heap, and moves the
+program break like virtual_sbrk, unless the heap was initialised with
+VIRTUAL_RESERVED, in which case the memory is already there.
+*/
+static void heap_grow (struct heap_ctrl * ctrl, int32_t increment) {
+	if (ctrl->flags & VIRTUAL_RESERVED) {
+		return;
+	}
+	void* success = virtual_sbrk (increment);
+	if (success == (void *)(-1)) {
+		perror("virtual sbrk failed!\n");
+		exit(0);
+	}
+}
+
+/*
+This function removes the entry at the given index from our data
+structure, moving all following entries one index back, and gives the
+freed metadata byte back with virtual_sbrk. The search hint is moved
+along, or back to the first block if its block is removed.
+
+parameters:
+buddy - our data structure (uint8_t*)
+index - index of the entry to be removed (uint64_t)
+
+return: void return type
+*/
+static void remove_entry (uint8_t * buddy, uint64_t index) {
+	struct heap_ctrl *ctrl = (struct heap_ctrl *) buddy - 1;
+	if (ctrl->hint_index > index) {
+		ctrl->hint_index -= 1;
+	} else if (ctrl->hint_index == index) {
+		ctrl->hint_index = 1;
+		ctrl->hint_offset = 0;
+	}
+	// short tails are moved while looking for the end, long ones with
+	// memmove once the end is found.
+	uint64_t t = index;
+	uint64_t stop = index + SCAN_SHORT;
+	while (t < stop && buddy [t] != END_INDEX) {
+		buddy [t] = buddy [t + 1];
+		t += 1;
+	}
+	if (t == stop) {
+		uint64_t end = scan_find (buddy, t, END_INDEX);
+		memmove (buddy + t, buddy + t + 1, end - t);
+	}
+	heap_grow (ctrl, -1);
+}
+
+/*
+This function takes in the heapstart, the index of a free block and its
+offset from the start of the heap, and merges the block with its buddy
+if the buddy is free and has the same size.
+The buddy of a block of size 2^j at offset o is the block at offset
+o xor 2^j, which is the next block if bit j of o is clear, and the
+previous block otherwise. Neighbouring blocks of the same size that are
+not buddies are never merged, as the result would not be aligned.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+index - index of the free block in our data structure (uint64_t)
+offset - offset of the block from the start of the heap (uint64_t)
+
+return: (int)
+on failure - it returns -1
+on success - it returns the index of the merged block, which starts at
+offset with the j-th bit cleared.
+*/
+int buddy_merge (void* heapstart, uint64_t index, uint64_t offset) {
+
+	uint8_t initial_size = heap_order (heapstart);
+	uint8_t *buddy = heap_buddy (heapstart);
+   
+	struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+   
+	uint32_t current = buddy [index];
+	if (current >= ALLOC || current >= initial_size) {
+	  	return -1;
+	}
+	 
+	// merging with the following/ next block 
+	if ((offset & ((uint64_t) 1 << current)) == 0) {
+		if (buddy [index + 1] != current) {
+			return -1;
+		}
+	  	buddy [index] = current + 1;
+	  	remove_entry (buddy, index + 1);
+	} else {
+		// merging with the previous block. Index 1 is always at
+		// offset 0, so it never gets here, and index 0 (the minimum
+		// size) is never looked at.
+		if (buddy [index - 1] != current) {
+			return -1;
+		}
+		buddy [index - 1] = current + 1;
+		remove_entry (buddy, index);
+		index = index - 1;
+	}
+	order_remove (ctrl, current);
+	order_remove (ctrl, current);
+	order_add (ctrl, current + 1);
+	return index;
+}
+
+/*
+This function takes in the heapstart, and index of the block to be split
+in our data structure as arguments, and splits the free block into two
+buddies, at index and index + 1.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+index - index of the block to be split in our data structure (uint64_t)
+
+return: 
+it splits the block if it is free. Return type is void.
+*/
+void buddy_split (void* heapstart, uint64_t index) {
+
+	uint8_t *buddy = heap_buddy (heapstart);
+
+	if (buddy [index] >= ALLOC) { //only free can be split
+		return;
+	}
+	
+	// the end can only come after the block.
+	uint64_t i = scan_find (buddy, index, END_INDEX);
+	struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+	heap_grow (ctrl, 1);
+	// now i is last index
+	buddy [i + 1] = END_INDEX;
+	
+	// moving contents of block one index ahead to create space
+	// for new block
+	if (i - index > SCAN_SHORT) {
+		memmove (buddy + index + 1, buddy + index, i - index);
+	} else {
+		uint64_t x = 0;
+		for (x = i; x > index; x --) {
+		    buddy [x] = buddy [x - 1];
+		}
+	}
+	
+	// splitting the block
+	buddy [index] = buddy [index + 1] - 1;	
+	buddy [index + 1] -= 1;
+	order_remove (ctrl, buddy [index] + 1);
+	order_add (ctrl, buddy [index]);
+	order_add (ctrl, buddy [index]);
+	
+	if (ctrl->hint_index > index) {
+		ctrl->hint_index += 1;
+	}
+}
+
+/*
+This function takes in the heapstart, and size of the block, and finds
+if there is any unallocated block of given size avaialable.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+index - size of the block to be found (uint64_t)
+
+return: (int)
+on failure - it returns 0
+on success - it returns the index of the unallocated block of given size.
+*/
+int leftmost_x_block_index (void * heapstart, uint32_t j) {
+
+	    uint8_t *buddy = heap_buddy (heapstart);
+
+	    if (j == 0) {
+	    	return 0;
+	    }
+	    // free blocks of size j store the order of j.
+	    uint64_t i = scan_find (buddy, 1, __builtin_ctzll (j));
+	    if (buddy [i] == END_INDEX) {
+	    	return 0;
+	    }
+	    return i;
+}
+
+/*
+This function takes in the heapstart, and ptr of a block, and finds the
+index of the block starting at ptr in our data structure, by adding up
+the sizes of the blocks before it. As blocks are usually freed close to
+where the last one was allocated or freed, the walk starts from the
+search hint, going forward or back, unless the start of the structure is
+closer. The whole structure can be searched, as a heap can hold many more
+blocks than initial_size.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of the block (void*)
+offset - set to the offset of the block from the start of the heap, if
+it is found (uint64_t*)
+
+return: (uint64_t)
+on failure - it returns 0, if no block starts at ptr.
+on success - it returns the index of the block.
+*/
+static uint64_t find_block (void * heapstart, void * ptr, uint64_t * offset) {
+
+    uint8_t initial_size = heap_order (heapstart);
+    uint64_t heap_length = (uint64_t) 1 << initial_size;
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+	
+    uint64_t diff = (uint8_t *) ptr - heap_data (heapstart);
+    uint64_t sum = 0;
+    uint64_t i = 1;
+    
+    if (ptr == NULL || diff >= heap_length) {
+    	return 0;
+    }
+    if (diff >= ctrl->hint_offset / 2) {
+    	i = ctrl->hint_index;
+    	sum = ctrl->hint_offset;
+    }
+    
+    while (sum > diff) {
+    	i -= 1;
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC) {
+    		temp -= ALLOC;
+    	}
+    	sum -= (uint64_t) 1 << temp;
+    }
+    while (buddy [i] != END_INDEX && sum < diff) {
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC) {
+    		temp -= ALLOC;
+    	}
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
+    }
+    
+    if (sum != diff || buddy [i] == END_INDEX) {
+    	return 0;
+    }
+    *offset = diff;
+    return i;
+}
+
+/*
+This function takes in the control block of a heap initialised with
+VIRTUAL_LIFO, and the order and offset of a block just freed, and
+remembers it, forgetting the oldest one if all RECENT_SLOTS are used.
+*/
+static void recent_push (struct heap_ctrl * ctrl, uint32_t order,
+			 uint64_t offset) {
+    uint32_t slot = ctrl->recent_top % RECENT_SLOTS;
+    ctrl->recent_order [slot] = order;
+    ctrl->recent_offset [slot] = offset;
+    ctrl->recent_top += 1;
+}
+
+/*
+This function takes in the heapstart of a heap initialised with
+VIRTUAL_LIFO, and an order, and finds the block of that order freed
+last. Remembered blocks that were merged, split or allocated since are
+forgotten on the way.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+order - order of the free block to be found (uint32_t)
+
+return: (uint64_t)
+on failure - it returns 0, if no remembered block of that order is free.
+on success - it returns the index of the block.
+*/
+static uint64_t recent_take (void * heapstart, uint32_t order) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint32_t n = 0;
+    for (n = 1; n <= RECENT_SLOTS; n ++) {
+    	uint32_t slot = (ctrl->recent_top - n) % RECENT_SLOTS;
+    	if (ctrl->recent_order [slot] != order) {
+    		continue;
+    	}
+    	ctrl->recent_order [slot] = RECENT_NONE;
+    	uint64_t offset = 0;
+    	uint64_t index = find_block (heapstart, heap_data (heapstart) +
+    				     ctrl->recent_offset [slot], &offset);
+    	if (index != 0 && buddy [index] == order) {
+    		return index;
+    	}
+    }
+    return 0;
+}
+
+/*
+This function takes in the heapstart of a heap initialised with
+VIRTUAL_LAZY, and the index and offset of a free block, and tells if
+its buddy is free too, so the two would have been merged.
+
+return: (uint64_t)
+on failure - it returns 0, if the buddy is not free at the same size.
+on success - it returns the index of the buddy.
+*/
+static uint64_t lazy_buddy (void * heapstart, uint64_t index,
+			    uint64_t offset) {
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint32_t order = buddy [index];
+    uint64_t other = (offset & ((uint64_t) 1 << order)) ?
+    		     index - 1 : index + 1;
+    if (order >= heap_order (heapstart) || buddy [other] != order) {
+    	return 0;
+    }
+    return other;
+}
+
+/*
+This function takes in the heapstart of a heap initialised with
+VIRTUAL_LAZY, and the index and offset of a free block about to be
+allocated. If it was left next to its free buddy, the pair is no
+longer waiting to be merged, and the count of its order goes down.
+*/
+static void lazy_taken (void * heapstart, uint64_t index, uint64_t offset) {
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint32_t order = heap_buddy (heapstart) [index];
+    if (ctrl->deferred [order] > 0 && lazy_buddy (heapstart, index, offset)) {
+    	ctrl->deferred [order] -= 1;
+    }
+}
+
+/*
+This function takes in the heapstart, and the index and offset of a
+free block in our data structure, and allocates it.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+i - index of the free block (uint64_t)
+offset - offset of the block from the start of the heap (uint64_t)
+
+return: (void*) the address of the block in virtual heap.
+*/
+static void * allocate_at (void * heapstart, uint64_t i, uint64_t offset) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t size = (uint64_t) 1 << buddy [i];
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    if (ctrl->flags & VIRTUAL_LAZY) {
+    	lazy_taken (heapstart, i, offset);
+    }
+    mark_allocated (ctrl, buddy, i);
+    
+    // the block may be written up to its end.
+    if (ctrl->zero_mark < offset + size) {
+    	ctrl->zero_mark = offset + size;
+    }
+    ctrl->hint_index = i;
+    ctrl->hint_offset = offset;
+    return (void*) (heap_data (heapstart) + offset);
+}
+
+/*
+This function takes in the heapstart, and the index of a free block in
+our data structure, and allocates it, like allocate_at.
+*/
+static void * allocate_index (void * heapstart, uint64_t i) {
+    // Calculating appropriate address of new allocated block.
+    uint64_t offset = scan_offset (heap_buddy (heapstart), 1, i);
+    return allocate_at (heapstart, i, offset);
+}
+
+/*
+This function takes in the heapstart, and size of the block, and finds
+if there is any unallocated block of given size avaialable. If available,
+then it returns the address of this block in virtual_heap.
+This function is used to check if an unallocated block of size 2^j is 
+available or not. And if available, its address is returned by malloc.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+j - size of the block to be found (uint32_t)
+
+return: (void*)
+on failure - it returns (void *)(-1).
+on success - it returns the address of the unallocated block of given
+size in virtual heap.
+*/
+void * leftmost_j_block (void * heapstart, uint32_t j) {
+		
+	    uint8_t *buddy = heap_buddy (heapstart);
+	    if (j == 0) {
+	    	return (void *)(-1);
+	    }
+	    uint64_t i = scan_find (buddy, 1, __builtin_ctzll (j));
+	    if (buddy [i] == END_INDEX) {
+	    	return (void *)(-1);
+	    }
+	    return allocate_index (heapstart, i);
+}
+
+
+/*
+This function appends one record to the allocation trace, if a trace
+is being recorded for this heap. Pointers are stored as offsets from
+heapstart, with NULL stored as 0.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+op - the traced operation, TRACE_MALLOC, TRACE_FREE or TRACE_REALLOC
+size - size passed to the operation (uint32_t)
+ptr - pointer passed to the operation (void*)
+result - offset of the returned block, or return code of free (uint64_t)
+
+return: void return type
+*/
+static void trace_write (void * heapstart, uint8_t op, uint32_t size,
+			 void * ptr, uint64_t result) {
+
+    if (trace_file == NULL || heapstart != trace_heap) {
+    	return;
+    }
+    struct trace_record rec;
+    uint8_t out [TRACE_RECORD_SIZE];
+    rec.op = op;
+    rec.size = size;
+    rec.ptr = (ptr == NULL) ? 0 : (uint64_t) (ptr - heapstart);
+    rec.result = result;
+    trace_encode (out, &rec);
+    fwrite (out, 1, TRACE_RECORD_SIZE, trace_file);
+}
+
+/*
+This function starts recording every virtual_malloc, virtual_free and
+virtual_realloc call made on the given heap to a binary trace file.
+The format is described in virtual_trace.h. Only one heap can be traced
+at a time; starting a new trace stops the previous one.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+path - the file the trace is written to (const char*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_trace_start (void * heapstart, const char * path) {
+
+    virtual_trace_stop ();
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL) {
+    	return 1;
+    }
+    
+    uint8_t header [TRACE_HEADER_SIZE];
+    memcpy (header, TRACE_MAGIC, 4);
+    trace_put (header + 4, TRACE_VERSION, 2);
+    header [6] = heap_order (heapstart);
+    header [7] = heap_buddy (heapstart) [0];
+    if (fwrite (header, 1, TRACE_HEADER_SIZE, fp) != TRACE_HEADER_SIZE) {
+    	fclose (fp);
+    	return 1;
+    }
+    trace_file = fp;
+    trace_heap = heapstart;
+    return 0;
+}
+
+/*
+This function stops the trace started by virtual_trace_start, and
+flushes it to disk. It does nothing if no trace is being recorded.
+
+return: void return type
+*/
+void virtual_trace_stop (void) {
+    if (trace_file != NULL) {
+    	fclose (trace_file);
+    }
+    trace_file = NULL;
+    trace_heap = NULL;
+}
+
+/*
+This function returns the order j of the block that holds size bytes,
+the smallest j, and at least min_size, such that 2^j >= size.
+
+parameters:
+size - number of bytes (uint64_t)
+min_size - the minimum block size of the heap (uint32_t)
+
+return: (uint32_t) the order of the block
+*/
+static uint32_t block_order (uint64_t size, uint32_t min_size) {
+    uint32_t j = min_size;
+    while (((uint64_t) 1 << j) < size) {
+    	j += 1;
+    }
+    return j;
+}
+
+/*
+This function takes in the heapstart, the orders with a free block that
+can serve a request of order upper, and the flags of virtual_malloc_ex,
+and allocates the leftmost of those blocks for VIRTUAL_LONG_LIVED, or
+the rightmost for VIRTUAL_SHORT_LIVED, whatever its size. The block is
+split down to upper keeping the lower halves, or the upper halves, so
+the blocks of each kind are packed at their end of the heap.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+orders - bitmap of the orders to look at, not 0 (uint64_t)
+upper - order of the block to be allocated (uint32_t)
+flags - VIRTUAL_LONG_LIVED or VIRTUAL_SHORT_LIVED (uint32_t)
+
+return: (void*) the address of the block in virtual heap.
+*/
+static void * malloc_hinted (void * heapstart, uint64_t orders,
+			     uint32_t upper, uint32_t flags) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t end = scan_find (buddy, 1, END_INDEX);
+    uint64_t high = flags & VIRTUAL_SHORT_LIVED;
+    uint64_t index = high ? 0 : end;
+    while (orders != 0) {
+    	uint32_t j = __builtin_ctzll (orders);
+    	orders &= orders - 1;
+    	uint64_t i = high ? scan_rfind (buddy, end, j) : scan_find (buddy, 1, j);
+    	if (high ? i > index : i < index) {
+    		index = i;
+    	}
+    }
+    uint32_t k = buddy [index];
+    if (!high) {
+    	while (k > upper) {
+    		buddy_split (heapstart, index);
+    		k -= 1;
+    	}
+    	return allocate_index (heapstart, index);
+    }
+    // counted from the end, as the block is usually close to it.
+    uint64_t offset = ((uint64_t) 1 << heap_order (heapstart)) -
+    		      scan_offset (buddy, index, end);
+    while (k > upper) {
+    	buddy_split (heapstart, index);
+    	k -= 1;
+    	index += 1;
+    	offset += (uint64_t) 1 << k;
+    }
+    return allocate_at (heapstart, index, offset);
+}
+
+/*
+This function takes in the control block of a heap, the order of a
+request and the flags of virtual_malloc_ex, and returns the bitmap of
+the orders the request may take a free block of. A split calls
+virtual_sbrk, unless the heap was initialised with VIRTUAL_RESERVED.
+*/
+static uint64_t order_limit (struct heap_ctrl * ctrl, uint32_t upper,
+			     uint32_t flags) {
+    uint32_t top = 63;
+    if (flags & VIRTUAL_NO_SPLIT_ABOVE_ORDER (0)) {
+    	top = (flags >> 8) & 0x3f;
+    	if (top < upper) {
+    		top = upper;
+    	}
+    }
+    if ((flags & VIRTUAL_EXACT_ORDER) ||
+        ((flags & VIRTUAL_NO_GROW) && !(ctrl->flags & VIRTUAL_RESERVED))) {
+    	top = upper;
+    }
+    return ~(uint64_t) 0 >> (63 - top);
+}
+
+/*
+This function takes in the heapstart, the order of the block, and the
+flags of virtual_malloc_ex, and allocates a block of exactly 2^order
+bytes if possible. The order is between the minimum and the initial
+size.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+upper - order of the block to be allocated (uint32_t)
+flags - the flags of virtual_malloc_ex but VIRTUAL_ZERO, or 0 (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of the block in virtual heap.
+*/
+static void * malloc_order (void * heapstart, uint32_t upper, uint32_t flags) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+
+    // the smallest order of at least 2^upper bytes with a free block.
+    // Its leftmost block, or the one freed last, is split down. The
+    // lower halves are then the only blocks of their order.
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint64_t limit = (flags == 0) ? ~(uint64_t) 0 :
+    		     order_limit (ctrl, upper, flags);
+    uint64_t orders = (ctrl->free_orders >> upper << upper) & limit;
+    if (orders == 0 && (ctrl->flags & VIRTUAL_LAZY) &&
+        virtual_coalesce (heapstart) > 0) {
+    	orders = (ctrl->free_orders >> upper << upper) & limit;
+    }
+    if (orders == 0) {
+    	return NULL;
+    }
+    if (flags & (VIRTUAL_LONG_LIVED | VIRTUAL_SHORT_LIVED)) {
+    	return malloc_hinted (heapstart, orders, upper, flags);
+    }
+    uint32_t k = __builtin_ctzll (orders);
+    uint64_t index = 0;
+    if (ctrl->flags & VIRTUAL_LIFO) {
+    	index = recent_take (heapstart, k);
+    }
+    if (index == 0) {
+    	index = scan_find (buddy, 1, k);
+    }
+    while (k > upper) {
+    	buddy_split (heapstart, index);
+    	k -= 1;
+    }
+    return allocate_index (heapstart, index);
+}
+
+/*
+This function takes in the heapstart, size of the block, and the flags
+of virtual_malloc_ex, and allocates a block if possible. It is the
+untraced implementation behind virtual_malloc, and is also used by
+virtual_realloc.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+size - size of the block to be allocated (uint32_t)
+flags - the flags of virtual_malloc_ex but VIRTUAL_ZERO, or 0 (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of block of given size in virtual heap.
+*/
+static void * malloc_block (void * heapstart, uint32_t size, uint32_t flags) {
+
+    uint64_t heap_length = (uint64_t) 1 << heap_order (heapstart);
+
+    if (size == 0 ) {
+    	return NULL;
+    }
+    
+    if (size > heap_length) {
+     	return NULL;
+    }
+    
+    return malloc_order (heapstart,
+    			 block_order (size, heap_buddy (heapstart) [0]), flags);
+}
+
+/*
+This function takes in the heapstart, and size of the block, and
+allocates a block if possible
+
+parameters:
+heapstart - the address where the heap starts (void*)
+size - size of the block to be allocated (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of block of given size in virtual heap.
+*/
+void * virtual_malloc (void * heapstart, uint32_t size) {
+
+    void *result = malloc_block (heapstart, size, 0);
+    trace_write (heapstart, TRACE_MALLOC, size, NULL,
+    		 (result == NULL) ? 0 : (uint64_t) (result - heapstart));
+    return result;
+}
+
+/*
+This function takes in the heapstart, and the order of a block, and
+allocates a block of 2^order bytes like virtual_malloc. Callers that
+know the order, such as BuddyHeap with a size known at compile time,
+skip working it out from the size.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+order - the block is of size 2^order, between the minimum and the
+initial size (uint8_t)
+
+return: (void*)
+on failure - it returns NULL, also if order is out of range.
+on success - it returns the address of the block in virtual heap.
+*/
+void * virtual_malloc_order (void * heapstart, uint8_t order) {
+
+    void *result = NULL;
+    if (order >= heap_buddy (heapstart) [0] && order <= heap_order (heapstart)) {
+    	result = malloc_order (heapstart, order, 0);
+    }
+    trace_write (heapstart, TRACE_MALLOC,
+    		 (order < 32) ? (uint32_t) 1 << order : UINT32_MAX, NULL,
+    		 (result == NULL) ? 0 : (uint64_t) (result - heapstart));
+    return result;
+}
+
+/*
+This function takes in the heapstart, size of the block, flags, and
+where to store the usable size, and allocates a block like
+virtual_malloc, with the flags controlling where it is placed and which
+of the slow paths it may take.
+
+Blocks with VIRTUAL_LONG_LIVED are taken from the leftmost free block
+that fits, and those with VIRTUAL_SHORT_LIVED from the rightmost one,
+whatever its size, and also on VIRTUAL_LIFO heaps. So transient blocks
+are allocated and freed at the top of the heap, away from the permanent
+ones at the bottom, and merge back into large blocks once they are
+freed. Without a hint, the block is placed like in virtual_malloc.
+
+VIRTUAL_ZERO fills the whole block with zeros, like virtual_calloc.
+VIRTUAL_EXACT_ORDER only takes a free block of the size of the request,
+and VIRTUAL_NO_SPLIT_ABOVE_ORDER(order) does not split free blocks
+larger than 2^order bytes, so the cost of the splits is bounded.
+VIRTUAL_NO_GROW never moves the program break, so it does not split at
+all, unless the heap was initialised with VIRTUAL_RESERVED. When these
+leave no block, it fails instead of taking a larger one.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+size - size of the block to be allocated (uint32_t)
+flags - VIRTUAL_LONG_LIVED or VIRTUAL_SHORT_LIVED, VIRTUAL_ZERO,
+VIRTUAL_EXACT_ORDER, VIRTUAL_NO_GROW, VIRTUAL_NO_SPLIT_ABOVE_ORDER(order),
+or 0 (uint32_t)
+usable - set to the size of the block, which can all be used, or to 0
+on failure, unless it is NULL (uint64_t*)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of block of given size in virtual heap.
+*/
+void * virtual_malloc_ex (void * heapstart, uint32_t size, uint32_t flags,
+			  uint64_t * usable) {
+
+    uint64_t zero_mark = heap_ctrl (heapstart)->zero_mark;
+    uint8_t *result = malloc_block (heapstart, size, flags & ~VIRTUAL_ZERO);
+    trace_write (heapstart, TRACE_MALLOC, size, NULL,
+    		 (result == NULL) ? 0 : (uint64_t) (result - (uint8_t *) heapstart));
+    uint64_t block = 0;
+    if (result != NULL) {
+    	block = (uint64_t) 1 << block_order (size, heap_buddy (heapstart) [0]);
+    }
+    if (result != NULL && (flags & VIRTUAL_ZERO)) {
+    	// as in virtual_calloc, only below the zero mark.
+    	uint64_t offset = result - heap_data (heapstart);
+    	if (offset < zero_mark) {
+    		uint64_t dirty = zero_mark - offset;
+    		memset (result, 0, dirty < block ? dirty : block);
+    	}
+    }
+    if (usable != NULL) {
+    	*usable = block;
+    }
+    return result;
+}
+
+/*
+This function takes in the heapstart, a number of elements and the size
+of each, and allocates a zero filled block for them.
+
+Only the part of the block below the zero mark can hold old data, as
+nothing from the zero mark on was ever allocated. On VIRTUAL_ZEROED heaps
+that part is often empty, or only the start of the block, so only that
+dirty range is cleared.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+count - number of elements (uint32_t)
+size - size of each element (uint32_t)
+
+return: (void*)
+on failure - it returns NULL, also if count * size does not fit in 32 bits.
+on success - it returns the address of the zero filled block.
+*/
+void * virtual_calloc (void * heapstart, uint32_t count, uint32_t size) {
+
+    uint64_t total = (uint64_t) count * size;
+    if (total > UINT32_MAX) {
+    	return NULL;
+    }
+    uint64_t zero_mark = heap_ctrl (heapstart)->zero_mark;
+    uint8_t *result = virtual_malloc (heapstart, total);
+    if (result == NULL) {
+    	return NULL;
+    }
+    uint64_t offset = result - heap_data (heapstart);
+    if (offset < zero_mark) {
+    	uint64_t dirty = zero_mark - offset;
+    	memset (result, 0, dirty < total ? dirty : total);
+    }
+    return result;
+}
+
+/*
+This function takes in the heapstart, and the index and offset of a
+free block, and merges it with its buddies, till possible.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+index - index of the block in our data structure (uint64_t)
+offset - offset of the block from the start of the heap (uint64_t)
+
+return: void return type
+*/
+static void merge_index (void * heapstart, uint64_t index, uint64_t offset) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+
+    // merging the buddies, till possible.
+    while (1 > 0) {
+
+    	int64_t success = buddy_merge (heapstart, index, offset);
+    	if (success == -1) {
+    		break;
+    	} else {
+    		// the merged block starts at the lower buddy.
+    		offset &= ~((uint64_t) 1 << (buddy [success] - 1));
+    		index = success;
+    	}
+    	
+    }
+    ctrl->hint_index = index;
+    ctrl->hint_offset = offset;
+}
+
+/*
+This function takes in the heapstart, and the index and offset of an
+allocated block, and deallocates it, merging it with its buddies, or,
+with VIRTUAL_LAZY, leaving that to virtual_coalesce.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+index - index of the block in our data structure (uint64_t)
+offset - offset of the block from the start of the heap (uint64_t)
+
+return: void return type
+*/
+static void free_index (void * heapstart, uint64_t index, uint64_t offset) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+
+    mark_free (ctrl, buddy, index);
+    
+    if (ctrl->flags & VIRTUAL_LAZY) {
+    	ctrl->hint_index = index;
+    	ctrl->hint_offset = offset;
+    	// only a block whose buddy is free too counts, others would
+    	// not have merged anyway.
+    	uint32_t order = buddy [index];
+    	if (ctrl->flags & VIRTUAL_LIFO) {
+    		recent_push (ctrl, order, offset);
+    	}
+    	if (lazy_buddy (heapstart, index, offset) &&
+    	    ++ ctrl->deferred [order] > ctrl->watermark [order]) {
+    		virtual_coalesce (heapstart);
+    	}
+    	return;
+    }
+    merge_index (heapstart, index, offset);
+    if (ctrl->flags & VIRTUAL_LIFO) {
+    	recent_push (ctrl, buddy [ctrl->hint_index], ctrl->hint_offset);
+    }
+}
+
+/*
+This function takes in the heapstart, and merges every free block with
+its buddy, till possible, in one pass over our data structure. The
+entries are moved back over the merged ones as it goes, and the freed
+metadata bytes are given back with virtual_sbrk at the end. It is only
+needed for heaps initialised with VIRTUAL_LAZY, where it also runs on
+its own; other heaps never have free buddies left unmerged.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (uint64_t) the number of merges done.
+*/
+uint64_t virtual_coalesce (void * heapstart) {
+
+    uint8_t initial_size = heap_order (heapstart);
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint64_t merged = 0;
+    uint64_t end = 0;
+    uint64_t from = 1;
+    uint64_t to = 1;
+    
+    // the entries before to are the blocks seen so far, merged, and
+    // end is where the last of them ends.
+    while (buddy [from] != END_INDEX) {
+    	uint32_t temp = buddy [from];
+    	buddy [to] = temp;
+    	from += 1;
+    	to += 1;
+    	end += (uint64_t) 1 << (temp >= ALLOC ? temp - ALLOC : temp);
+    	
+    	// the last two are buddies if they are free, of the same size,
+    	// and the first starts at a multiple of twice that size.
+    	while (to > 2 && buddy [to - 1] < ALLOC &&
+    	       buddy [to - 1] == buddy [to - 2] &&
+    	       buddy [to - 1] < initial_size) {
+    		uint32_t j = buddy [to - 1];
+    		uint64_t pair = (uint64_t) 2 << j;
+    		if (((end - pair) & (pair - 1)) != 0) {
+    			break;
+    		}
+    		buddy [to - 2] = j + 1;
+    		to -= 1;
+    		order_remove (ctrl, j);
+    		order_remove (ctrl, j);
+    		order_add (ctrl, j + 1);
+    		merged += 1;
+    	}
+    }
+    buddy [to] = END_INDEX;
+    if (merged > 0) {
+    	heap_grow (ctrl, - (int32_t) merged);
+    }
+    memset (ctrl->deferred, 0, sizeof (ctrl->deferred));
+    ctrl->hint_index = 1;
+    ctrl->hint_offset = 0;
+    return merged;
+}
+
+/*
+This function takes in the heapstart of a heap initialised with
+VIRTUAL_LAZY, an order, and a count, and sets how many blocks of that
+order may be freed without merging before virtual_coalesce runs. A
+larger count saves more merges and splits when blocks of that size are
+freed and allocated over and over, and leaves more of the heap split
+into small blocks in between.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+order - order of the blocks, 2^order bytes (uint8_t)
+count - the watermark, 0 merges every block when it is freed (uint32_t)
+
+return: (int)
+on failure - it returns 1, if order is larger than the heap.
+on success - it returns 0.
+*/
+int virtual_set_watermark (void * heapstart, uint8_t order, uint32_t count) {
+    if (order > heap_order (heapstart)) {
+    	return 1;
+    }
+    heap_ctrl (heapstart)->watermark [order] = count;
+    return 0;
+}
+
+/*
+This function takes in the heapstart, and ptr of the block, and
+deallocates the block if possible. It is the untraced implementation
+behind virtual_free, and is also used by virtual_realloc.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be deallocated (ptr*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+static int free_block (void * heapstart, void * ptr) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+	
+    uint64_t offset = 0;
+    uint64_t index = find_block (heapstart, ptr, &offset);
+    
+    if (index == 0 || buddy [index] < ALLOC) {
+    	return 1;
+    }
+    free_index (heapstart, index, offset);
+    return 0;
+}
+
+/*
+This function takes in the heapstart, and ptr of the block, and
+deallocates the block if possible
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be deallocated (ptr*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_free(void * heapstart, void * ptr) {
+
+    int result = free_block (heapstart, ptr);
+    trace_write (heapstart, TRACE_FREE, 0, ptr, result);
+    return result;
+}
+
+/*
+This function takes in the heapstart, and ptr of a block, and returns
+the size of the block, which is the requested size rounded up to a power
+of two. All of it can be used by the caller.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of an allocated block (void*)
+
+return: (uint64_t)
+on failure - it returns 0, if ptr is not an allocated block.
+on success - it returns the size of the block.
+*/
+uint64_t virtual_usable_size (void * heapstart, void * ptr) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t offset = 0;
+    uint64_t index = find_block (heapstart, ptr, &offset);
+    if (index == 0 || buddy [index] < ALLOC) {
+    	return 0;
+    }
+    return (uint64_t) 1 << (buddy [index] - ALLOC);
+}
+
+/*
+This function takes in the heapstart, ptr of a block and its order, and
+deallocates the block, if it is an allocated block of exactly that
+order. A ptr that is not aligned to the order is rejected before our
+data structure is searched; any other ptr is found like in virtual_free,
+as our data structure cannot be indexed by offset, so the order only
+validates the block. It is the untraced implementation behind
+virtual_free_sized and virtual_free_order.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be deallocated (void*)
+order - the block is of size 2^order (uint32_t)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+static int free_order (void * heapstart, void * ptr, uint32_t order) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t diff = (uint8_t *) ptr - heap_data (heapstart);
+    uint64_t offset = 0;
+    uint64_t index = 0;
+    
+    if (ptr != NULL && order <= heap_order (heapstart) &&
+        (diff & (((uint64_t) 1 << order) - 1)) == 0) {
+    	index = find_block (heapstart, ptr, &offset);
+    }
+    if (index != 0 && buddy [index] == order + ALLOC) {
+    	free_index (heapstart, index, offset);
+    	return 0;
+    }
+    return 1;
+}
+
+/*
+This function takes in the heapstart, ptr of a block and the size it was
+allocated with, and deallocates the block.
+
+The size gives the order of the block, so a ptr that is not aligned to
+that order is rejected before our data structure is searched, and the
+block found must be of exactly that order. Any size from the requested
+size up to the usable size is accepted.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be deallocated (void*)
+size - the size the block was allocated with (uint32_t)
+
+return: (int)
+on failure - it returns 1, also if size does not match the block.
+on success - it returns 0.
+*/
+int virtual_free_sized (void * heapstart, void * ptr, uint32_t size) {
+
+    int result = 1;
+    if (size != 0) {
+    	result = free_order (heapstart, ptr,
+    			     block_order (size, heap_buddy (heapstart) [0]));
+    }
+    trace_write (heapstart, TRACE_FREE, 0, ptr, result);
+    return result;
+}
+
+/*
+This function takes in the heapstart, ptr of a block and its order, and
+deallocates the block like virtual_free_sized, for callers that know the
+order, like virtual_malloc_order.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be deallocated (void*)
+order - the block is of size 2^order (uint8_t)
+
+return: (int)
+on failure - it returns 1, also if order does not match the block.
+on success - it returns 0.
+*/
+int virtual_free_order (void * heapstart, void * ptr, uint8_t order) {
+    int result = free_order (heapstart, ptr, order);
+    trace_write (heapstart, TRACE_FREE, 0, ptr, result);
+    return result;
+}
+
+/*
+This function takes in the heapstart, and the offset and size of a block
+that was just freed, and allocates exactly that block again, splitting
+the free block that now contains it. It is used by virtual_realloc to
+undo the free when the new block cannot be allocated. As free buddies
+are merged, this restores the data structure as it was, except on
+VIRTUAL_LAZY heaps, where buddies that were left unmerged before may
+now be merged; the same blocks are free either way.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+offset - offset of the block from the start of the heap (uint64_t)
+order - the block is of size 2^order (uint32_t)
+
+return: void return type
+*/
+static void reserve_block (void * heapstart, uint64_t offset, uint32_t order) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+
+    uint64_t i = 1;
+    uint64_t sum = 0;
+    
+    // finding the block containing offset.
+    while (1 > 0) {
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC) {
+    		temp -= ALLOC;
+    	}
+    	if (sum + ((uint64_t) 1 << temp) > offset) {
+    		break;
+    	}
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
+    }
+    
+    // splitting it down, keeping the half that contains offset.
+    while (buddy [i] > order) {
+    	buddy_split (heapstart, i);
+    	if (offset >= sum + ((uint64_t) 1 << buddy [i])) {
+    		sum += (uint64_t) 1 << buddy [i];
+    		i += 1;
+    	}
+    }
+    mark_allocated (heap_ctrl (heapstart), buddy, i);
+}
+
+/*
+This function takes in the heapstart, ptr of the block, and new size, and
+reallocates the block if possible. It is the untraced implementation
+behind virtual_realloc.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be reallocated (ptr*)
+size - number of bytes to be reallocated (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns new address of reallocated block.
+*/
+static void * realloc_block (void * heapstart, void * ptr, uint32_t size) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+
+    // a NULL or unknown ptr, or an already freed block, cannot be
+    // reallocated.
+    uint64_t offset = 0;
+    uint64_t index = find_block (heapstart, ptr, &offset);
+    if (index == 0 || buddy [index] < ALLOC) {
+    	return NULL;
+    }
+    uint32_t order = buddy [index] - ALLOC;
+    
+    // deallocating the specified block of memory. It is merged even on
+    // lazy heaps, as the merged block may be the one it grows into.
+    mark_free (heap_ctrl (heapstart), buddy, index);
+    merge_index (heapstart, index, offset);
+    
+    if (size == 0) {
+    	// Act as virtual free only, and return NULL
+    	return NULL;
+    }
+    
+    // allocating a block of given size. Only the contents of the old
+    // block are copied over.
+    void* res = malloc_block (heapstart, size, 0);
+    if (res != NULL) {
+    	uint64_t old_size = (uint64_t) 1 << order;
+    	memmove (res, ptr, (size < old_size) ? size : old_size);
+    	return res;
+    }
+    
+    // if the program reaches this point, then that means the block
+    // cannot be reallocated. In this case we allocate the old block
+    // again, and return.
+    reserve_block (heapstart, offset, order);
+    return NULL;
+ }
+
+/*
+This function takes in the heapstart, ptr of the block, and new size, and
+reallocates the block if possible.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of block to be reallocated (ptr*)
+size - number of bytes to be reallocated (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns new address of reallocated block.
+*/
+void * virtual_realloc(void * heapstart, void * ptr, uint32_t size) {
+
+    void *result = realloc_block (heapstart, ptr, size);
+    trace_write (heapstart, TRACE_REALLOC, size, ptr,
+    		 (result == NULL) ? 0 : (uint64_t) (result - heapstart));
+    return result;
+}
+
+/*
+This function takes in our data structure, the index and order of a
+block, and a larger order, and checks that the entries after the block
+are free buddies of orders order up to target - 1, which the block can
+grow into.
+*/
+static int expand_fits (const uint8_t * buddy, uint64_t index,
+			uint32_t order, uint32_t target) {
+    uint32_t j = 0;
+    for (j = order; j < target; j ++) {
+    	if (buddy [index + 1 + j - order] != j) {
+    		return 0;
+    	}
+    }
+    return 1;
+}
+
+/*
+This function takes in the heapstart, ptr of a block, and a new size,
+and grows the block in place to hold new_size bytes, if possible. The
+block is never moved.
+
+A block of size 2^j at offset o can grow to 2^k if o is a multiple of
+2^k and the rest of that range is free. Once free buddies are merged,
+the rest is exactly the free buddies of sizes 2^j up to 2^(k - 1),
+which follow the block in our data structure. They are merged into the
+block. On VIRTUAL_LAZY heaps the range may still hold smaller free
+blocks, so virtual_coalesce runs first when they do not match.
+
+Like the other functions outside malloc, free and realloc, this is not
+recorded by virtual_trace_start.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-index - index of the block to be split in our data structure (uint64_t)
+ptr - address of an allocated block (void*)
+new_size - number of bytes the block has to hold (uint32_t)
 
-return: (int)
-on failure - it returns -1
-on success - it returns the index of the first buddy created from
-the split
+return: (uint64_t)
+on failure - it returns 0, and the block is left as it was.
+on success - it returns the new size of the block, which is the old size
+if it already holds new_size bytes.
 */
-int buddy_merge (void* heapstart, uint64_t index) {
-
-	uint8_t *initial = (uint8_t *) heapstart;
-	uint8_t initial_size = *initial;
-	uint64_t heap_length = 1 << initial_size;
-	uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
-   
-	uint32_t current = buddy [index];
-	uint32_t next = buddy [index + 1];
+uint64_t virtual_try_expand (void * heapstart, void * ptr, uint32_t new_size) {
 
-	if (buddy [index] == END_INDEX) {
-	  	return -1;
-	}
-	 
-	 // merging with the following/ next block 
-	if (next == current && next <= ALLOC) {
-	  	buddy [index] = next + 1;
-	  	uint32_t t = index + 1;
-	  	
-	  	while (buddy [t] != END_INDEX) {
-	  		buddy [t] = buddy [t + 1];
-	  		t += 1;		
-	  	}
-	  	buddy [t - 1] = END_INDEX;
-		void* success = virtual_sbrk (-1);
-    		if (success == (void *)(-1)) {
-        		perror("virtual sbrk failed!\n");
-    			exit(0);
-    		}
-	  	return index;
-	}
-	  
-	// cannot merge with previous block if index is 1, because index
-	// 0 is reserved for minimum block size.  
-	if (index == 1) {
-	  	return -1;
-	}
-	
-	// merging with the previous block
-	uint32_t previous = buddy [index - 1];
-	if (current == previous && current <= ALLOC) {
-	  	buddy [index - 1] = previous + 1;
-	  	uint32_t t = index;
-	
-	  	while (buddy [t] != END_INDEX) {
-	  		buddy [t] = buddy [t + 1];
-	  		t += 1;	
-	  	}
-	  	buddy [t - 1] = END_INDEX;
-		void* success = virtual_sbrk (-1);
-    		if (success == (void *)(-1)) {
-        		perror("virtual sbrk failed!\n");
-    			exit(0);
-    		}
-	  	return index - 1;
-	  }
-	
-	return -1;
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t offset = 0;
+    uint64_t index = find_block (heapstart, ptr, &offset);
+    if (index == 0 || buddy [index] < ALLOC) {
+    	return 0;
+    }
+    uint32_t order = buddy [index] - ALLOC;
+    uint32_t target = block_order (new_size, buddy [0]);
+    if (target <= order) {
+    	return (uint64_t) 1 << order;
+    }
+    if (target > heap_order (heapstart) ||
+        (offset & (((uint64_t) 1 << target) - 1)) != 0) {
+    	return 0;
+    }
+    
+    // checking the buddies before merging any of them.
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    if (!expand_fits (buddy, index, order, target)) {
+    	if (!(ctrl->flags & VIRTUAL_LAZY) || virtual_coalesce (heapstart) == 0) {
+    		return 0;
+    	}
+    	// the entries before the block may have moved back.
+    	index = find_block (heapstart, ptr, &offset);
+    	if (!expand_fits (buddy, index, order, target)) {
+    		return 0;
+    	}
+    }
+    uint32_t j = 0;
+    for (j = order; j < target; j ++) {
+    	buddy [index] += 1;
+    	remove_entry (buddy, index + 1);
+    	order_remove (ctrl, j);
+    }
+    
+    if (ctrl->zero_mark < offset + ((uint64_t) 1 << target)) {
+    	ctrl->zero_mark = offset + ((uint64_t) 1 << target);
+    }
+    return (uint64_t) 1 << target;
 }
 
 /*
-This function takes in the heapstart, and index of the first buddy
-to be merged, and merges the buddies to form an unallocated block 
-if they both are free.
+This function takes in the heapstart, ptr of a block, and a new size,
+and shrinks the block in place to the smallest block holding new_size
+bytes. The block keeps its address, and the freed upper part is given
+back as free blocks of sizes 2^k up to 2^(j - 1). None of them can be
+merged, as the lowest one's buddy is the block itself.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-index - index of the first buddy to be merged in our data structure
- (uint64_t)
+ptr - address of an allocated block (void*)
+new_size - number of bytes the block has to hold (uint32_t)
 
-return: 
-it merges the buddies if possible. Return type is void.
+return: (uint64_t)
+on failure - it returns 0, also if new_size is 0 or larger than the block.
+on success - it returns the new size of the block, which is the old size
+if no smaller block holds new_size bytes.
 */
-void buddy_split (void* heapstart, uint64_t index) {
-
-	uint8_t *initial = (uint8_t *) heapstart;
-	uint8_t initial_size = *initial;
-	uint64_t heap_length = 1 << initial_size;
-	uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
+uint64_t virtual_try_shrink (void * heapstart, void * ptr, uint32_t new_size) {
 
-	if (buddy [index] >= ALLOC) { //only free can be split
-		return;
-	}
-	
-	uint32_t i = 1;
-	while (buddy [i] != END_INDEX) {
-	    	i += 1; 	
-	}
-	void* success = virtual_sbrk (1);
-	if (success == (void *)(-1)) {
-		perror("virtual sbrk failed!\n");
-	    	exit(0);
-	}
-	// now i is last index
-	buddy [i + 1] = END_INDEX;
-	uint32_t x = 0;
-	
-	// moving contents of block one index ahead to create space
-	// for new block
-	for (x = i; x > index; x --) {
-	    buddy [x] = buddy [x - 1];
-	}
-	
-	// splitting the block
-	buddy [index] = buddy [index + 1] - 1;	
-	buddy [index + 1] -= 1;
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t offset = 0;
+    uint64_t index = find_block (heapstart, ptr, &offset);
+    if (index == 0 || buddy [index] < ALLOC || new_size == 0) {
+    	return 0;
+    }
+    uint32_t order = buddy [index] - ALLOC;
+    uint32_t target = block_order (new_size, buddy [0]);
+    if (target > order) {
+    	return 0;
+    }
+    
+    // splitting the block as if it was free, keeping the lower half.
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    mark_free (ctrl, buddy, index);
+    while (buddy [index] > target) {
+    	buddy_split (heapstart, index);
+    }
+    mark_allocated (ctrl, buddy, index);
+    return (uint64_t) 1 << target;
 }
 
 /*
-This function takes in the heapstart, and size of the block, and finds
-if there is any unallocated block of given size avaialable.
+This function takes in the heapstart, and ptr of a block, and moves the
+block to the lowest free place in the heap that can hold it, if that is
+below the block. The lowest free block of at least the same size is
+split down to the size of the block, the contents are copied, and the
+old block is freed and merged. Moving blocks down this way gathers the
+free space at the top of the heap into large blocks.
+
+Only the caller knows where ptr is stored, so it has to update every
+reference to the block. Relocations are not recorded by
+virtual_trace_start.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-index - size of the block to be found (uint64_t)
+ptr - address of an allocated block (void*)
 
-return: (int)
-on failure - it returns 0
-on success - it returns the index of the unallocated block of given size.
+return: (void*)
+on failure - it returns NULL, if ptr is not an allocated block.
+on success - it returns the new address of the block, which is ptr if
+there is no free place below it.
 */
-int leftmost_x_block_index (void * heapstart, uint32_t j) {
-
-	    uint8_t *initial = (uint8_t *) heapstart;
-	    uint8_t initial_size = *initial;
-	    uint64_t heap_length = 1 << initial_size;
-	    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
+void * virtual_relocate (void * heapstart, void * ptr) {
 
-    	    uint32_t i = 1;
-    	    
-	    while (buddy [i] != END_INDEX) {
-	    
-	        if (buddy [i] <= ALLOC) {
-	    	uint64_t size = 1 << buddy[i];
-	    		
-	    		// finding block of size j, and returning its index
-	    		if (size == j) {
-	    			return i;
-	    		} 	
-	    	}
-	    	
-	    i += 1;   
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t offset = 0;
+    uint64_t index = find_block (heapstart, ptr, &offset);
+    if (index == 0 || buddy [index] < ALLOC) {
+    	return NULL;
+    }
+    uint32_t order = buddy [index] - ALLOC;
+    
+    // finding the lowest free block of at least this size. All blocks
+    // before index are below the block.
+    uint64_t i = 1;
+    uint64_t sum = 0;
+    while (i < index && (buddy [i] >= ALLOC || buddy [i] < order)) {
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC) {
+    		temp -= ALLOC;
     	}
-	    return 0;
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
+    }
+    if (i == index) {
+    	return ptr;
+    }
+    
+    // every split puts one more entry before the old block.
+    while (buddy [i] > order) {
+    	buddy_split (heapstart, i);
+    	index += 1;
+    }
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    mark_allocated (ctrl, buddy, i);
+    if (ctrl->zero_mark < sum + ((uint64_t) 1 << order)) {
+    	ctrl->zero_mark = sum + ((uint64_t) 1 << order);
+    }
+    
+    uint8_t *result = heap_data (heapstart) + sum;
+    memcpy (result, ptr, (uint64_t) 1 << order);
+    free_index (heapstart, index, offset);
+    return result;
 }
 
-
 /*
-This function takes in the heapstart, and size of the block, and finds
-if there is any unallocated block of given size avaialable. If available,
-then it returns the address of this block in virtual_heap.
-This function is used to check if an unallocated block of size 2^j is 
-available or not. And if available, its address is returned by malloc.
+This function takes in the heapstart, and a mover, which owns the blocks
+virtual_defrag_step may move. Only one mover can be set per heap; NULL
+removes it.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-j - size of the block to be found (uint32_t)
+mover - the callback deciding about and tracking moves (virtual_mover)
+ctx - passed to every call of mover (void*)
 
-return: (void*)
-on failure - it returns (void *)(-1).
-on success - it returns the address of the unallocated block of given
-size in virtual heap.
+return: void return type
 */
-void * leftmost_j_block (void * heapstart, uint32_t j) {
-		
-	    uint8_t *initial = (uint8_t *) heapstart;
-	    uint8_t initial_size = *initial;
-	    uint64_t heap_length = 1 << initial_size;
-	    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
-    	    uint32_t i = 1;
-
-	    while (buddy [i] != END_INDEX) {
-	        if (buddy [i] <= ALLOC) {
-
-	    		uint64_t size = 1 << buddy[i];
-	    		if (size == j) {
-	    			uint64_t offset = 0;
-	    			uint32_t g = 0;
-	    			
-	    			// Calculating appropriate address of new 
-	    			// allocated block.
-	    			for (g = 1; g < i; g ++) {
-	    		
-	    				uint32_t value = buddy [g];
-	    				if (buddy [g] >= ALLOC) {
-	    					value -= ALLOC;
-	    				}
-	    				offset += (1 << value);
-	    			}
-
-	    			buddy [i] += ALLOC;
-	    			return (void*) (heapstart + 1 + offset);
-	    		}
-	    
-	    	}
-	    i += 1; 
-    	}
-	return (void *)(-1);
+void virtual_set_mover (void * heapstart, virtual_mover mover, void * ctx) {
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    ctrl->mover = mover;
+    ctrl->mover_ctx = ctx;
 }
 
+static uint64_t now_ns (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
 /*
-This function takes in the heapstart, and size of the block, and
-allocates a block if possible
+This function takes in the heapstart, and an order k, and finds the
+block of size 2^k that is cheapest to empty: it holds free space, only
+allocated blocks the mover allows to move, and the fewest allocated
+bytes of all such blocks. Once emptied, it merges into a free block of
+size 2^k.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-size - size of the block to be allocated (uint32_t)
+k - order of the block to be emptied (uint32_t)
+lo - set to the offset of the block, if one is found (uint64_t*)
 
-return: (void*)
-on failure - it returns NULL.
-on success - it returns the address of block of given size in virtual heap.
+return: (int)
+on failure - it returns 0, if no block of size 2^k can be emptied.
+on success - it returns 1.
 */
-void * virtual_malloc (void * heapstart, uint32_t size) {
-
-    uint8_t *initial = (uint8_t *) heapstart;
-    uint8_t initial_size = *initial;
-    uint64_t heap_length = 1 << initial_size;
-    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
-
-    uint64_t i = 0;
-    uint64_t lower = 0; // j - 1
-    uint64_t upper = 1; // j
-    uint64_t min = buddy [0];
-
-    if (size == 0 ) {
-    	return NULL;
-    }
-    
-    if (size > heap_length) {
-     	return NULL;
-    }
+static int defrag_pick (void * heapstart, uint32_t k, uint64_t * lo) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint64_t region = (uint64_t) 1 << k;
+    uint64_t best = region;
+    uint64_t live = 0;
+    int movable = 1;
+    uint64_t sum = 0;
+    uint64_t i = 1;
     
-    if (size <= (1 << min) ) {
-    	upper = min;
-    	
-    } else {
-    	while (1 > 0) {
-    	lower = i;
-    	upper = i + 1;
-    		if ( (size > (1 << lower)) && (size <= (1 << upper))) {
-    			break;
+    while (buddy [i] != END_INDEX) {
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC) {
+    		temp -= ALLOC;
+    		// blocks of order k or more are whole regions on their own,
+    		// so only smaller ones are looked at.
+    		if (temp < k) {
+    			live += (uint64_t) 1 << temp;
+    			movable = movable && ctrl->mover (ctrl->mover_ctx,
+    						heap_data (heapstart) + sum, NULL);
     		}
-    	i += 1;
     	}
-    }
-
-    // checking if unallocated block of size 2^j bytes exists or not.
-    uint64_t two_j = 1 << upper;
-    void* result = leftmost_j_block (heapstart, two_j);
-    if (result != (void *) (-1)) {
-    	return result;
-    }
-    
-    uint32_t y = 1;
-    for (y=1; y<=initial_size; y++) {
-        // finding block of size 2^(j + y), and splitting it till required.
-    	uint32_t x = 0;
-    	for (x = y; x > 0; x --){
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
     	
-    		two_j = 1 << (x + upper);
-    		uint64_t index = leftmost_x_block_index (heapstart, two_j);
-    		// if block found, then we need to split it.
-    		if (index == 0) {
-    			break;
-    		} else {
-    			buddy_split (heapstart, index);
+    	if ((sum & (region - 1)) == 0) {
+    		if (temp < k && movable && live > 0 && live < best) {
+    			best = live;
+    			*lo = sum - region;
     		}
+    		live = 0;
+    		movable = 1;
     	}
-    	
-    	// checking if we were able to find a block of size 2^j or not.
-    	// else we repeat the steps for block of size 2^(j + y + 1)
-    	two_j = 1 << upper;
-    	result = leftmost_j_block (heapstart, two_j);
-    	if (result != (void *) (-1)) {
-    		return result;
-    	}
- 
     }
-    return NULL;
+    return best < region;
 }
 
 /*
-This function takes in the heapstart, and ptr of the block, and
-deallocates the block if possible
+This function takes in the heapstart, and the order of a block, and
+allocates a block of that order outside the given range, from the
+smallest free block that holds it, at the lowest address.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-ptr - address of block to be deallocated (ptr*)
+order - order of the block to be allocated (uint32_t)
+lo - start of the range to be avoided (uint64_t)
+hi - end of the range to be avoided (uint64_t)
 
-return: (int)
-on failure - it returns 1.
-on success - it returns 0.
+return: (uint8_t*)
+on failure - it returns NULL.
+on success - it returns the address of the new block.
 */
-int virtual_free(void * heapstart, void * ptr) {
+static uint8_t * defrag_place (void * heapstart, uint32_t order, uint64_t lo,
+			       uint64_t hi) {
 
-    uint8_t *initial = (uint8_t *) heapstart;
-    uint8_t initial_size = *initial;
-    uint64_t heap_length = 1 << initial_size;
-    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
-	
-    uint64_t diff = ptr - heapstart - 1;
-    uint64_t index = 0;
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t best = 0;
+    uint64_t best_offset = 0;
     uint64_t sum = 0;
+    uint64_t i = 1;
     
-    uint32_t i = 0;
-    
-    // finding the index of the required block in the data structure
-    for (i = 1; i <= initial_size; i++) {
-    
+    while (buddy [i] != END_INDEX) {
     	uint32_t temp = buddy [i];
     	if (temp >= ALLOC) {
     		temp -= ALLOC;
+    	} else if (temp >= order && (sum < lo || sum >= hi) &&
+    		   (best == 0 || temp < buddy [best])) {
+    		best = i;
+    		best_offset = sum;
     	}
-    	
-    	sum += (1 << temp);
-    	if (sum == diff) {
-    		index = i + 1;
-    		break;
-    	}
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
     }
-    
-    if (diff == 0) {
-    	index = 1;
+    if (best == 0) {
+    	return NULL;
     }
-    
-    // freeing the block
-    if (buddy [index] <= ALLOC) {
-    	return 1;
-    } else {
-    	buddy [index] -= ALLOC;
+    while (buddy [best] > order) {
+    	buddy_split (heapstart, best);
     }
-    
-    // merging the buddies, till possible.
-    while (1 > 0) {
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    mark_allocated (ctrl, buddy, best);
+    if (ctrl->zero_mark < best_offset + ((uint64_t) 1 << order)) {
+    	ctrl->zero_mark = best_offset + ((uint64_t) 1 << order);
+    }
+    return heap_data (heapstart) + best_offset;
+}
 
-    	int64_t success = buddy_merge (heapstart, index);
-    	if (success == -1) {
-    		break;
-    	} else {
-    		index = success;
+/*
+This function takes in the heapstart, and the range of a block being
+emptied, and finds the first allocated block in it.
+
+return: (uint64_t)
+on failure - it returns 0, if the range holds no allocated block.
+on success - it returns the index of the block, and sets offset.
+*/
+static uint64_t defrag_next (void * heapstart, uint64_t lo, uint64_t hi,
+			     uint64_t * offset) {
+
+    uint8_t *buddy = heap_buddy (heapstart);
+    uint64_t sum = 0;
+    uint64_t i = 1;
+    while (buddy [i] != END_INDEX && sum < hi) {
+    	uint32_t temp = buddy [i];
+    	if (temp >= ALLOC) {
+    		if (sum >= lo) {
+    			*offset = sum;
+    			return i;
+    		}
+    		temp -= ALLOC;
     	}
-    	
+    	sum += (uint64_t) 1 << temp;
+    	i += 1;
     }
     return 0;
 }
+
 /*
-This function copies given number of bytes from one array to another.
+This function takes in the heapstart, and a time budget, and does one
+bounded step of defragmentation. It looks for the smallest block size
+larger than the largest free block, picks the block of that size which
+is cheapest to empty, and moves the allocated blocks out of it, into
+the smallest free blocks elsewhere, until it is free and merges. This is
+repeated until the budget is used up or nothing more can be done.
+
+Only blocks the mover set with virtual_set_mover allows are moved. The
+mover is told about every move, after the contents were copied, and
+before the old block is freed. If it refuses the move then, the copy is
+freed instead, and the step ends.
 
 parameters:
-buddy - the destination array where contents need to copied (uint8_t*)
-temp - the source array from where contents need to copied (uint8_t*)
-temp_c - the number of bytes to be copied (uint32_t)
+heapstart - the address where the heap starts (void*)
+budget_ns - time to spend, in nanoseconds. At least one block is moved
+if possible (uint64_t)
 
-return: void return type
+return: (uint32_t) the number of blocks moved, 0 once no step can
+create a larger free block.
 */
-void copy (uint8_t* buddy, uint8_t* temp, uint32_t temp_c) {
-	uint32_t i = 0;
-	for (i = 0; i < temp_c; i ++) {
-		buddy [i] = temp [i];
-	}
+uint32_t virtual_defrag_step (void * heapstart, uint64_t budget_ns) {
+
+    uint8_t initial_size = heap_order (heapstart);
+    uint8_t *buddy = heap_buddy (heapstart);
+    struct heap_ctrl *ctrl = heap_ctrl (heapstart);
+    uint64_t start = now_ns ();
+    uint32_t moved = 0;
+
+    if (ctrl->mover == NULL) {
+    	return 0;
+    }
+    while (1 > 0) {
+    	// the emptied blocks only merge here on lazy heaps.
+    	if (ctrl->flags & VIRTUAL_LAZY) {
+    		virtual_coalesce (heapstart);
+    	}
+    	struct virtual_stats stats;
+    	virtual_stats (heapstart, &stats);
+    	if (stats.free_blocks == 0) {
+    		return moved;
+    	}
+    	uint32_t k = block_order (stats.largest_free, 0) + 1;
+    	uint64_t lo = 0;
+    	while (k <= initial_size && !defrag_pick (heapstart, k, &lo)) {
+    		k += 1;
+    	}
+    	if (k > initial_size) {
+    		return moved;
+    	}
+    	uint64_t hi = lo + ((uint64_t) 1 << k);
+    	
+    	// emptying the chosen block.
+    	uint64_t offset = 0;
+    	uint64_t index = defrag_next (heapstart, lo, hi, &offset);
+    	while (index != 0) {
+    		uint32_t order = buddy [index] - ALLOC;
+    		uint8_t *from = heap_data (heapstart) + offset;
+    		uint8_t *to = defrag_place (heapstart, order, lo, hi);
+    		if (to == NULL) {
+    			return moved;
+    		}
+    		memcpy (to, from, (uint64_t) 1 << order);
+    		if (ctrl->mover (ctrl->mover_ctx, from, to) == 0) {
+    			// refused, so the owner still uses from.
+    			index = find_block (heapstart, to, &offset);
+    			free_index (heapstart, index, offset);
+    			return moved;
+    		}
+    		index = find_block (heapstart, from, &offset);
+    		free_index (heapstart, index, offset);
+    		moved += 1;
+    		if (now_ns () - start >= budget_ns) {
+    			return moved;
+    		}
+    		index = defrag_next (heapstart, lo, hi, &offset);
+    	}
+    }
 }
 
 /*
-This function takes in the heapstart, ptr of the block, and new size, and
-reallocates the block if possible.
+This function takes in the heapstart, an alignment and the size of the
+block, and allocates a block starting at a multiple of alignment.
+
+A block of size 2^j starts at a multiple of 2^j from the data region, so
+it is enough to ask for a block of at least alignment bytes, as long as
+the data region itself is aligned to alignment. Heaps initialised with
+VIRTUAL_ALIGNED can serve any alignment up to PAGE_SIZE this way.
 
 parameters:
 heapstart - the address where the heap starts (void*)
-ptr - address of block to be reallocated (ptr*)
-size - number of bytes to be reallocated (uint32_t)
+alignment - required alignment, a power of two (uint32_t)
+size - size of the block to be allocated (uint32_t)
 
 return: (void*)
-on failure - it returns NULL.
-on success - it returns new address of reallocated block.
+on failure - it returns NULL, also if alignment is not a power of two or
+is larger than the alignment of the data region.
+on success - it returns the address of the aligned block.
 */
-void * virtual_realloc(void * heapstart, void * ptr, uint32_t size) {
-
-    uint8_t *initial = (uint8_t *) heapstart;
-    uint8_t initial_size = *initial;
-    uint64_t heap_length = 1 << initial_size;
-    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
+void * virtual_aligned_alloc (void * heapstart, uint32_t alignment,
+			      uint32_t size) {
 
-    uint32_t temp_c = 0;
-    uint8_t temp [13000];
-    
-    // copying the contents of data structure temporarily.
-    while (buddy [temp_c] != END_INDEX) {
-    	temp [temp_c] = buddy [temp_c];
-    	temp_c += 1;	
-    }
-    
-    // deallocating the specified block of memory
-    uint32_t result = virtual_free (heapstart, ptr);
-    if (result != 0) {
-    	copy (buddy, temp, temp_c) ;
-    	return NULL;
-    }
-    
-    // if ptr is NULL, and size is 0, then we allocate a block of
-    // specified size.
-    if (ptr == NULL && size != 0) {
-    	void *res = virtual_malloc (heapstart, size);
-    	if (res != NULL) {
-    		memmove (res, ptr, size);
-    		return res;
-    	}
-    }
-    
-    // if ptr is NULL, and size is zero, then we return NULL, and restore
-    // the contents of our data structure
-    if (ptr == NULL && size == 0) {
-    	copy (buddy, temp, temp_c);
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
     	return NULL;
     }
-    
-    if (ptr != NULL && size == 0) {
-    	// Act as virtual free only, and return NULL
+    uintptr_t data = (uintptr_t) heap_data (heapstart);
+    if ((data & (alignment - 1)) != 0) {
     	return NULL;
     }
-    
-    // If all these situations are not true, then we allocate a block
-    // of given size.
-    void* res = virtual_malloc (heapstart, size);
-    if (res != NULL) {
-    	memmove (res, ptr, size);
-    	return res;
+    if (size < alignment) {
+    	size = alignment;
     }
-    
-    // if the program reaches this point, then that means the block
-    // cannot be reallocated. In this case we restore the contents
-    // of data structure, and return.
-    copy (buddy, temp, temp_c);
-    return NULL;
- }
+    return virtual_malloc (heapstart, size);
+}
  
 /*
 This function takes in the heapstart, and prints the current state of 
@@ -508,10 +2320,7 @@ heapstart - the address where the heap starts (void*)
 return: void return type.
 */
 void virtual_info(void * heapstart) {
-    uint8_t *initial = (uint8_t *) heapstart;
-    uint8_t initial_size = *initial;
-    uint64_t heap_length = 1 << initial_size;
-    uint8_t *buddy = (uint8_t *) (heapstart + heap_length + 1);
+    uint8_t *buddy = heap_buddy (heapstart);
 
     uint32_t i = 1;
     while (buddy [i] != END_INDEX) {
@@ -523,7 +2332,7 @@ void virtual_info(void * heapstart) {
     		temp -= ALLOC;
     	}
     
-    	uint64_t size = 1 << temp;
+    	uint64_t size = (uint64_t) 1 << temp;
     	
     	if (buddy[i] < ALLOC) {
     		printf ("free %lu\n", size);
@@ -537,20 +2346,43 @@ void virtual_info(void * heapstart) {
     
 }
 
+/*
+This function takes in the heapstart, and summarises the current state
+of the buddy allocator into the given stats structure. It walks the
+same data structure as virtual_info, but does not print anything.
 
+parameters:
+heapstart - the address where the heap starts (void*)
+stats - the structure to be filled in (struct virtual_stats*)
 
+return: void return type.
+*/
+void virtual_stats (void * heapstart, struct virtual_stats * stats) {
+    uint8_t initial_size = heap_order (heapstart);
+    uint64_t heap_length = (uint64_t) 1 << initial_size;
+    uint8_t *buddy = heap_buddy (heapstart);
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+    memset (stats, 0, sizeof (*stats));
+    stats->heap_size = heap_length;
+    
+    uint32_t i = 1;
+    while (buddy [i] != END_INDEX) {
+    	uint32_t temp = buddy [i];
+    	if (buddy [i] >= ALLOC) {
+    		temp -= ALLOC;
+    	}
+    	uint64_t size = (uint64_t) 1 << temp;
+    	
+    	if (buddy [i] < ALLOC) {
+    		stats->free_bytes += size;
+    		stats->free_blocks += 1;
+    		if (size > stats->largest_free) {
+    			stats->largest_free = size;
+    		}
+    	} else {
+    		stats->allocated_bytes += size;
+    		stats->allocated_blocks += 1;
+    	}
+    	i += 1;
+    }
+}
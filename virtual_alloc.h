@@ -1,12 +1,106 @@
+#ifndef VIRTUAL_ALLOC_H
+#define VIRTUAL_ALLOC_H
+
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// init_allocator_ex flags
+#define VIRTUAL_ALIGNED 0x1
+#define VIRTUAL_ZEROED 0x2
+#define VIRTUAL_RESERVED 0x4
+#define VIRTUAL_LAZY 0x8
+#define VIRTUAL_LIFO 0x10
+
+// virtual_malloc_ex flags
+#define VIRTUAL_LONG_LIVED 0x1
+#define VIRTUAL_SHORT_LIVED 0x2
+#define VIRTUAL_ZERO 0x4
+#define VIRTUAL_EXACT_ORDER 0x8
+#define VIRTUAL_NO_GROW 0x10
+#define VIRTUAL_NO_SPLIT_ABOVE_ORDER(order) (0x20 | ((uint32_t) (order) & 0x3f) << 8)
+
+/*
+Owner of movable blocks, for virtual_defrag_step. Called with to NULL,
+it returns 1 if the block at from may be moved. Otherwise the block at
+from was just copied to to, and the owner updates its references and
+returns 1, or returns 0 to refuse the move, and keeps using from.
+*/
+typedef int (*virtual_mover)(void * ctx, void * from, void * to);
+
+struct virtual_stats {
+    uint64_t heap_size;
+    uint64_t free_bytes;
+    uint64_t allocated_bytes;
+    uint64_t largest_free;
+    uint32_t free_blocks;
+    uint32_t allocated_blocks;
+};
+
 void init_allocator(void * heapstart, uint8_t initial_size, uint8_t min_size);
 
+void init_allocator_ex(void * heapstart, uint8_t initial_size, uint8_t min_size,
+                       uint32_t flags);
+
+uint64_t virtual_reserve_size(void * heapstart, uint8_t initial_size,
+                              uint8_t min_size, uint32_t flags);
+
+int virtual_check(void * heapstart);
+
+void virtual_reset_hints(void * heapstart);
+
+void * virtual_data(void * heapstart);
+
+int virtual_is_aligned(void * heapstart);
+
 void * virtual_malloc(void * heapstart, uint32_t size);
 
+void * virtual_malloc_order(void * heapstart, uint8_t order);
+
+void * virtual_malloc_ex(void * heapstart, uint32_t size, uint32_t flags,
+                        uint64_t * usable);
+
 int virtual_free(void * heapstart, void * ptr);
 
+int virtual_free_sized(void * heapstart, void * ptr, uint32_t size);
+
+int virtual_free_order(void * heapstart, void * ptr, uint8_t order);
+
+uint64_t virtual_coalesce(void * heapstart);
+
+int virtual_set_watermark(void * heapstart, uint8_t order, uint32_t count);
+
+uint64_t virtual_usable_size(void * heapstart, void * ptr);
+
 void * virtual_realloc(void * heapstart, void * ptr, uint32_t size);
 
+uint64_t virtual_try_expand(void * heapstart, void * ptr, uint32_t new_size);
+
+uint64_t virtual_try_shrink(void * heapstart, void * ptr, uint32_t new_size);
+
+void * virtual_relocate(void * heapstart, void * ptr);
+
+void virtual_set_mover(void * heapstart, virtual_mover mover, void * ctx);
+
+uint32_t virtual_defrag_step(void * heapstart, uint64_t budget_ns);
+
+void * virtual_calloc(void * heapstart, uint32_t count, uint32_t size);
+
+void * virtual_aligned_alloc(void * heapstart, uint32_t alignment, uint32_t size);
+
 void virtual_info(void * heapstart);
+
+void virtual_stats(void * heapstart, struct virtual_stats * stats);
+
+int virtual_trace_start(void * heapstart, const char * path);
+
+void virtual_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef VIRTUAL_ALLOCATOR_HPP
+#define VIRTUAL_ALLOCATOR_HPP
+
+#include "virtual_alloc.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+A classic Allocator over one buddy heap, for containers and templates
+that take an allocator type rather than a memory resource. Every copy,
+and every rebound copy, allocates from the same heap, and the heap goes
+along when containers are copied, moved or swapped.
+
+allocate_at_least returns the whole block, which is a power of two, so
+a container can grow into it before asking for more. It returns
+std::allocation_result where the library has it (C++23), and the
+equivalent virtual_alloc::allocation_result otherwise.
+
+Blocks are aligned to alignof(T) through virtual_aligned_alloc, which
+needs a heap initialised with VIRTUAL_ALIGNED. On other heaps the data
+region starts right after the size byte, so the constructor throws
+std::invalid_argument for them, whatever T is, as rebound copies may
+need the alignment.
+*/
+
+namespace virtual_alloc {
+
+#if defined (__cpp_lib_allocate_at_least)
+template <class Pointer>
+using allocation_result = std::allocation_result<Pointer>;
+#else
+template <class Pointer>
+struct allocation_result {
+    Pointer ptr;
+    std::size_t count;
+};
+#endif
+
+template <class T>
+class BuddyAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    template <class U>
+    struct rebind {
+    	typedef BuddyAllocator<U> other;
+    };
+
+    explicit BuddyAllocator (void * heapstart)
+        : heapstart_ (heapstart) {
+    	if (!virtual_is_aligned (heapstart)) {
+    		throw std::invalid_argument (
+    			"BuddyAllocator needs a VIRTUAL_ALIGNED heap");
+    	}
+    }
+
+    template <class U>
+    BuddyAllocator (const BuddyAllocator<U> & other) noexcept
+        : heapstart_ (other.heapstart ()) {}
+
+    void * heapstart () const noexcept {
+    	return heapstart_;
+    }
+
+    T * allocate (std::size_t n) {
+    	return static_cast<T *> (allocate_bytes (n));
+    }
+
+    allocation_result<T *> allocate_at_least (std::size_t n) {
+    	void *ptr = allocate_bytes (n);
+    	std::size_t count = virtual_usable_size (heapstart_, ptr) / sizeof (T);
+    	return allocation_result<T *> {static_cast<T *> (ptr), count};
+    }
+
+    // n is the count passed to allocate, or returned by
+    // allocate_at_least.
+    void deallocate (T * ptr, std::size_t n) noexcept {
+    	virtual_free_sized (heapstart_, ptr, block_size (n));
+    }
+
+private:
+    // the size the block was allocated with, as virtual_aligned_alloc
+    // rounds it up to the alignment.
+    static std::uint32_t block_size (std::size_t n) noexcept {
+    	std::size_t bytes = n * sizeof (T);
+    	return static_cast<std::uint32_t> (bytes < alignof (T) ?
+    					   alignof (T) : bytes);
+    }
+
+    void * allocate_bytes (std::size_t n) {
+    	if (n > UINT32_MAX / sizeof (T)) {
+    		throw std::bad_alloc ();
+    	}
+    	void *ptr = virtual_aligned_alloc (heapstart_, alignof (T),
+    					   block_size (n));
+    	if (ptr == nullptr) {
+    		throw std::bad_alloc ();
+    	}
+    	return ptr;
+    }
+
+    void *heapstart_;
+};
+
+template <class T, class U>
+bool operator== (const BuddyAllocator<T> & a,
+		 const BuddyAllocator<U> & b) noexcept {
+    return a.heapstart () == b.heapstart ();
+}
+
+template <class T, class U>
+bool operator!= (const BuddyAllocator<T> & a,
+		 const BuddyAllocator<U> & b) noexcept {
+    return a.heapstart () != b.heapstart ();
+}
+
+}
+
+#endif
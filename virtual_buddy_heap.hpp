@@ -0,0 +1,119 @@
+#ifndef VIRTUAL_BUDDY_HEAP_HPP
+#define VIRTUAL_BUDDY_HEAP_HPP
+
+#include "virtual_alloc.h"
+#include <cstddef>
+#include <cstdint>
+
+/*
+A buddy heap whose geometry is fixed at compile time. The heap is an
+ordinary heap, usable with the C functions through heapstart(), but the
+order of the block a request gets is constexpr. allocate<Size>() and
+deallocate<Size>() check at compile time that Size fits, and call
+virtual_malloc_order and virtual_free_order with the order as a
+constant, so the order is never worked out from the size at run time.
+contains(), offset() and at() only use the heap size and the start of
+the data region, which is looked up once.
+
+The heap lives in memory the caller provides, reserve_size(memory)
+bytes of it, and is initialised with VIRTUAL_RESERVED, so it never
+calls virtual_sbrk and any number of them can live in one process.
+*/
+
+namespace virtual_alloc {
+
+template <unsigned InitialOrder, unsigned MinOrder, std::uint32_t Flags = 0>
+class BuddyHeap {
+    static_assert (MinOrder <= InitialOrder,
+    		   "the minimum block cannot be larger than the heap");
+    static_assert (InitialOrder < 64, "the heap order must fit in 6 bits");
+    static_assert (InitialOrder - MinOrder < 48,
+    		   "the block table would not be addressable");
+    static_assert ((Flags & ~(std::uint32_t) (VIRTUAL_ALIGNED |
+    					      VIRTUAL_ZEROED |
+    					      VIRTUAL_LAZY |
+    					      VIRTUAL_LIFO)) == 0,
+    		   "only VIRTUAL_ALIGNED, VIRTUAL_ZEROED, VIRTUAL_LAZY and "
+    		   "VIRTUAL_LIFO can be chosen");
+
+public:
+    static constexpr unsigned initial_order = InitialOrder;
+    static constexpr unsigned min_order = MinOrder;
+    static constexpr std::uint64_t heap_size = (std::uint64_t) 1 << InitialOrder;
+
+    // whether a request of size bytes can ever be served.
+    static constexpr bool fits (std::uint64_t size) noexcept {
+    	return size != 0 && size <= heap_size && size <= UINT32_MAX;
+    }
+
+    // the order of the block a request of size bytes gets.
+    static constexpr unsigned order_of (std::uint64_t size) noexcept {
+    	unsigned j = MinOrder;
+    	while (((std::uint64_t) 1 << j) < size) {
+    		j += 1;
+    	}
+    	return j;
+    }
+
+    // the memory a heap at memory needs, see virtual_reserve_size.
+    static std::uint64_t reserve_size (void * memory) noexcept {
+    	return virtual_reserve_size (memory, InitialOrder, MinOrder,
+    				     Flags | VIRTUAL_RESERVED);
+    }
+
+    explicit BuddyHeap (void * memory) noexcept : heapstart_ (memory) {
+    	init_allocator_ex (memory, InitialOrder, MinOrder,
+    			   Flags | VIRTUAL_RESERVED);
+    	data_ = static_cast<std::uint8_t *> (virtual_data (memory));
+    }
+
+    BuddyHeap (const BuddyHeap &) = delete;
+    BuddyHeap & operator= (const BuddyHeap &) = delete;
+
+    void * heapstart () const noexcept {
+    	return heapstart_;
+    }
+
+    void * allocate (std::uint32_t size) noexcept {
+    	return virtual_malloc (heapstart_, size);
+    }
+
+    template <std::uint64_t Size>
+    void * allocate () noexcept {
+    	static_assert (fits (Size), "the block does not fit the heap");
+    	constexpr unsigned order = order_of (Size);
+    	return virtual_malloc_order (heapstart_, order);
+    }
+
+    int deallocate (void * ptr, std::uint32_t size) noexcept {
+    	return virtual_free_sized (heapstart_, ptr, size);
+    }
+
+    template <std::uint64_t Size>
+    int deallocate (void * ptr) noexcept {
+    	static_assert (fits (Size), "the block does not fit the heap");
+    	constexpr unsigned order = order_of (Size);
+    	return virtual_free_order (heapstart_, ptr, order);
+    }
+
+    bool contains (const void * ptr) const noexcept {
+    	const std::uint8_t *p = static_cast<const std::uint8_t *> (ptr);
+    	return p >= data_ && p < data_ + heap_size;
+    }
+
+    std::uint64_t offset (const void * ptr) const noexcept {
+    	return static_cast<const std::uint8_t *> (ptr) - data_;
+    }
+
+    void * at (std::uint64_t offset) const noexcept {
+    	return data_ + offset;
+    }
+
+private:
+    void *heapstart_;
+    std::uint8_t *data_;
+};
+
+}
+
+#endif
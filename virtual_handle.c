@@ -0,0 +1,364 @@
+#include "virtual_handle.h"
+#include "virtual_alloc.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+#define HANDLE_INDEX_BITS 24
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define TABLE_ALIGN _Alignof (max_align_t)
+
+/*
+A handle is the index of its entry plus one in its low 24 bits, and the
+generation of the entry in its high 8 bits. The generation changes
+every time an entry is freed, so stale handles are rejected.
+*/
+struct handle_entry {
+    void *ptr; // NULL if the entry is free
+    uint32_t next_free; // next free entry plus one, if the entry is free
+    uint16_t pins;
+    uint8_t generation;
+};
+
+struct handle_move {
+    uintptr_t addr;
+    uint32_t index;
+};
+
+/*
+The table lives in one block of the heap, allocated first, so it is
+never in the way of compaction. It holds the entries, the scratch space
+handle_compact sorts them in, and a hash map from the address of every
+live block to its entry plus one, for virtual_defrag_step, which only
+knows addresses.
+*/
+struct handle_table {
+    void *heapstart;
+    void *block; // the block the table lives in
+    uint32_t capacity;
+    uint32_t free_head; // first free entry plus one, 0 if none
+    struct handle_entry *entries;
+    struct handle_move *moves;
+    uint32_t *map;
+    uint32_t map_mask;
+};
+
+static inline uint8_t * align_up (uint8_t * ptr, uint32_t align) {
+    return (uint8_t *) (((uintptr_t) ptr + align - 1) &
+    			~(uintptr_t) (align - 1));
+}
+
+static uint32_t map_home (struct handle_table * table, void * ptr) {
+    uint64_t key = (uintptr_t) ptr;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key & table->map_mask;
+}
+
+// the slot of the map holding ptr, or the empty slot it would go in.
+static uint32_t map_find (struct handle_table * table, void * ptr) {
+    uint32_t i = map_home (table, ptr);
+    while (table->map [i] != 0 &&
+           table->entries [table->map [i] - 1].ptr != ptr) {
+    	i = (i + 1) & table->map_mask;
+    }
+    return i;
+}
+
+static void map_insert (struct handle_table * table, uint32_t index) {
+    table->map [map_find (table, table->entries [index].ptr)] = index + 1;
+}
+
+/*
+This function removes the block at ptr from the map, moving later slots
+of the same probe chain back so that lookups keep working.
+*/
+static void map_remove (struct handle_table * table, void * ptr) {
+    uint32_t i = map_find (table, ptr);
+    uint32_t j = i;
+    table->map [i] = 0;
+    while (1 > 0) {
+    	j = (j + 1) & table->map_mask;
+    	if (table->map [j] == 0) {
+    		return;
+    	}
+    	uint32_t home = map_home (table,
+    				  table->entries [table->map [j] - 1].ptr);
+    	// the slot at j can fill the hole at i only if its home slot is
+    	// not cyclically between i and j.
+    	if ((j > i && (home <= i || home > j)) ||
+    	    (j < i && (home <= i && home > j))) {
+    		table->map [i] = table->map [j];
+    		table->map [j] = 0;
+    		i = j;
+    	}
+    }
+}
+
+// moves the entry of index to ptr, keeping the map up to date.
+static void entry_move (struct handle_table * table, uint32_t index,
+			void * ptr) {
+    map_remove (table, table->entries [index].ptr);
+    table->entries [index].ptr = ptr;
+    map_insert (table, index);
+}
+
+/*
+This function is the mover of the heap of a table, see virtual_set_mover.
+Blocks of the table that are not pinned may be moved.
+*/
+static int handle_mover (void * ctx, void * from, void * to) {
+    struct handle_table *table = ctx;
+    uint32_t index = table->map [map_find (table, from)];
+    if (index == 0 || table->entries [index - 1].pins != 0) {
+    	return 0;
+    }
+    if (to != NULL) {
+    	entry_move (table, index - 1, to);
+    }
+    return 1;
+}
+
+/*
+This function takes in a table and a handle, and returns the entry of
+the handle if the handle is live, or NULL otherwise.
+*/
+static struct handle_entry * handle_entry (struct handle_table * table,
+					   virtual_handle handle) {
+    uint32_t index = handle & HANDLE_INDEX_MASK;
+    if (index == 0 || index > table->capacity) {
+    	return NULL;
+    }
+    struct handle_entry *entry = &table->entries [index - 1];
+    if (entry->ptr == NULL ||
+        entry->generation != handle >> HANDLE_INDEX_BITS) {
+    	return NULL;
+    }
+    return entry;
+}
+
+/*
+This function takes in the heapstart, and the number of handles, and
+creates a handle table for the heap. The table becomes the mover of the
+heap, so virtual_defrag_step can move its blocks.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+capacity - maximum number of live handles, below 2^24 (uint32_t)
+
+return: (struct handle_table*)
+on failure - it returns NULL.
+on success - it returns the new table.
+*/
+struct handle_table * handle_table_create (void * heapstart,
+					   uint32_t capacity) {
+
+    if (capacity == 0 || capacity > HANDLE_INDEX_MASK) {
+    	return NULL;
+    }
+    // the map is at most half full.
+    uint64_t map_size = 2;
+    while (map_size < 2 * (uint64_t) capacity) {
+    	map_size *= 2;
+    }
+    uint64_t size = sizeof (struct handle_table) + TABLE_ALIGN +
+    		    (uint64_t) capacity * (sizeof (struct handle_entry) +
+    					   sizeof (struct handle_move)) +
+    		    map_size * sizeof (uint32_t);
+    if (size > UINT32_MAX) {
+    	return NULL;
+    }
+    uint8_t *block = virtual_malloc (heapstart, size);
+    if (block == NULL) {
+    	return NULL;
+    }
+    struct handle_table *table = (struct handle_table *)
+    				 align_up (block, TABLE_ALIGN);
+    table->heapstart = heapstart;
+    table->block = block;
+    table->capacity = capacity;
+    table->entries = (struct handle_entry *) (table + 1);
+    table->moves = (struct handle_move *) (table->entries + capacity);
+    table->map = (uint32_t *) (table->moves + capacity);
+    table->map_mask = map_size - 1;
+
+    uint32_t i = 0;
+    for (i = 0; i < capacity; i ++) {
+    	table->entries [i].ptr = NULL;
+    	table->entries [i].next_free = (i + 1 < capacity) ? i + 2 : 0;
+    	table->entries [i].pins = 0;
+    	table->entries [i].generation = 0;
+    }
+    for (i = 0; i < map_size; i ++) {
+    	table->map [i] = 0;
+    }
+    table->free_head = 1;
+    virtual_set_mover (heapstart, handle_mover, table);
+    return table;
+}
+
+/*
+This function takes in a table, and a size, and allocates a relocatable
+block of size bytes.
+
+parameters:
+table - the handle table (struct handle_table*)
+size - size of the block to be allocated (uint32_t)
+
+return: (virtual_handle)
+on failure - it returns 0, if the block cannot be allocated or the table
+is full.
+on success - it returns the handle of the block, which starts unpinned.
+*/
+virtual_handle handle_alloc (struct handle_table * table, uint32_t size) {
+
+    if (table->free_head == 0) {
+    	return 0;
+    }
+    void *ptr = virtual_malloc (table->heapstart, size);
+    if (ptr == NULL) {
+    	return 0;
+    }
+    uint32_t index = table->free_head;
+    struct handle_entry *entry = &table->entries [index - 1];
+    table->free_head = entry->next_free;
+    entry->ptr = ptr;
+    entry->pins = 0;
+    map_insert (table, index - 1);
+    return ((uint32_t) entry->generation << HANDLE_INDEX_BITS) | index;
+}
+
+/*
+This function takes in a table, and a handle, and frees its block. The
+handle becomes invalid.
+
+parameters:
+table - the handle table (struct handle_table*)
+handle - the handle of the block (virtual_handle)
+
+return: (int)
+on failure - it returns 1, if the handle is not live or still pinned.
+on success - it returns 0.
+*/
+int handle_free (struct handle_table * table, virtual_handle handle) {
+
+    struct handle_entry *entry = handle_entry (table, handle);
+    if (entry == NULL || entry->pins != 0) {
+    	return 1;
+    }
+    virtual_free (table->heapstart, entry->ptr);
+    map_remove (table, entry->ptr);
+    entry->ptr = NULL;
+    entry->generation += 1;
+    entry->next_free = table->free_head;
+    table->free_head = (entry - table->entries) + 1;
+    return 0;
+}
+
+/*
+This function takes in a table, and a handle, and pins its block, which
+is not moved until it is unpinned as many times as it was pinned.
+
+parameters:
+table - the handle table (struct handle_table*)
+handle - the handle of the block (virtual_handle)
+
+return: (void*)
+on failure - it returns NULL, if the handle is not live.
+on success - it returns the address of the block.
+*/
+void * handle_pin (struct handle_table * table, virtual_handle handle) {
+
+    struct handle_entry *entry = handle_entry (table, handle);
+    if (entry == NULL || entry->pins == UINT16_MAX) {
+    	return NULL;
+    }
+    entry->pins += 1;
+    return entry->ptr;
+}
+
+/*
+This function takes in a table, and a handle, and undoes one pin of its
+block. The address returned by handle_pin must not be used once the
+block is no longer pinned.
+
+parameters:
+table - the handle table (struct handle_table*)
+handle - the handle of the block (virtual_handle)
+
+return: (int)
+on failure - it returns 1, if the handle is not live or not pinned.
+on success - it returns 0.
+*/
+int handle_unpin (struct handle_table * table, virtual_handle handle) {
+
+    struct handle_entry *entry = handle_entry (table, handle);
+    if (entry == NULL || entry->pins == 0) {
+    	return 1;
+    }
+    entry->pins -= 1;
+    return 0;
+}
+
+static int compare_moves (const void * a, const void * b) {
+    const struct handle_move *x = a;
+    const struct handle_move *y = b;
+    return (x->addr < y->addr) - (x->addr > y->addr);
+}
+
+/*
+This function takes in a table, and moves every unpinned block down into
+the lowest free space below it that holds it, with virtual_relocate.
+Blocks are moved from the top of the heap down, so the highest blocks
+fill the lowest holes first, and the free space gathers at the top.
+
+parameters:
+table - the handle table (struct handle_table*)
+
+return: (uint32_t) the number of blocks moved
+*/
+uint32_t handle_compact (struct handle_table * table) {
+
+    uint32_t count = 0;
+    uint32_t moved = 0;
+    uint32_t i = 0;
+    for (i = 0; i < table->capacity; i ++) {
+    	struct handle_entry *entry = &table->entries [i];
+    	if (entry->ptr != NULL && entry->pins == 0) {
+    		table->moves [count].addr = (uintptr_t) entry->ptr;
+    		table->moves [count].index = i;
+    		count += 1;
+    	}
+    }
+    qsort (table->moves, count, sizeof (struct handle_move), compare_moves);
+
+    for (i = 0; i < count; i ++) {
+    	struct handle_entry *entry = &table->entries [table->moves [i].index];
+    	void *ptr = virtual_relocate (table->heapstart, entry->ptr);
+    	if (ptr != NULL && ptr != entry->ptr) {
+    		entry_move (table, table->moves [i].index, ptr);
+    		moved += 1;
+    	}
+    }
+    return moved;
+}
+
+/*
+This function takes in a table, and frees every block allocated through
+it, and the table itself, and stops being the mover of the heap.
+
+parameters:
+table - the handle table (struct handle_table*)
+
+return: void return type
+*/
+void handle_table_destroy (struct handle_table * table) {
+    virtual_set_mover (table->heapstart, NULL, NULL);
+    uint32_t i = 0;
+    for (i = 0; i < table->capacity; i ++) {
+    	if (table->entries [i].ptr != NULL) {
+    		virtual_free (table->heapstart, table->entries [i].ptr);
+    	}
+    }
+    virtual_free (table->heapstart, table->block);
+}
@@ -0,0 +1,37 @@
+#ifndef VIRTUAL_HANDLE_H
+#define VIRTUAL_HANDLE_H
+
+#include <stdint.h>
+
+/*
+Relocatable allocations on top of the buddy allocator. Blocks allocated
+through a handle table are referred to by handles instead of pointers,
+and only get an address while they are pinned. Unpinned blocks may be
+moved by handle_compact, which moves them down into free space lower in
+the heap, so the free space left over merges into large blocks.
+The table is also the mover of its heap, so virtual_defrag_step can
+move unpinned blocks a few at a time instead.
+
+A handle is never 0. Freed handles become invalid, even when their slot
+in the table is reused.
+*/
+
+typedef uint32_t virtual_handle;
+
+struct handle_table;
+
+struct handle_table * handle_table_create(void * heapstart, uint32_t capacity);
+
+virtual_handle handle_alloc(struct handle_table * table, uint32_t size);
+
+int handle_free(struct handle_table * table, virtual_handle handle);
+
+void * handle_pin(struct handle_table * table, virtual_handle handle);
+
+int handle_unpin(struct handle_table * table, virtual_handle handle);
+
+uint32_t handle_compact(struct handle_table * table);
+
+void handle_table_destroy(struct handle_table * table);
+
+#endif
@@ -0,0 +1,154 @@
+#include "virtual_huge.h"
+#include "virtual_alloc.h"
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define HUGE_HEADER_SIZE 64
+#define HUGE_PAGE_SIZE ((uint64_t) 1 << VIRTUAL_HUGE_ORDER)
+
+/*
+The mapping starts with this header, and the heap follows it. The size
+byte is the last byte before a HUGE_PAGE_SIZE boundary, so the data
+region starts at the boundary, in both layouts.
+*/
+struct huge_header {
+    uint8_t *base;
+    uint64_t length;
+    uint8_t min_size;
+};
+
+_Static_assert (sizeof (struct huge_header) <= HUGE_HEADER_SIZE,
+		"the huge page header does not fit");
+
+static inline struct huge_header * huge_header (void * heapstart) {
+    return (struct huge_header *) ((uint8_t *) heapstart - HUGE_HEADER_SIZE);
+}
+
+/*
+This function takes in a range of the heap, and gives the kernel
+advice on backing it with huge pages. The advice may be refused, e.g.
+when transparent huge pages are disabled, which changes nothing but the
+speed, so it is not checked.
+*/
+static void huge_advise (void * start, uint64_t length, int huge) {
+#if defined (MADV_HUGEPAGE) && defined (MADV_NOHUGEPAGE)
+    madvise (start, length, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+}
+
+/*
+This function takes in the arguments of init_allocator_ex, and maps
+anonymous memory for a new heap, with the data region at a
+HUGE_PAGE_SIZE boundary. The memory is zero filled, so the heap is
+VIRTUAL_ZEROED, and it holds all the heap will ever need, so it is
+VIRTUAL_RESERVED; pages are only backed once they are used.
+
+parameters:
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+flags - VIRTUAL_ALIGNED, VIRTUAL_LAZY and VIRTUAL_LIFO, or 0 (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the heapstart of the new heap.
+*/
+void * virtual_huge_create (uint8_t initial_size, uint8_t min_size,
+			    uint32_t flags) {
+
+    flags |= VIRTUAL_ZEROED | VIRTUAL_RESERVED;
+    // only the alignment of heapstart matters.
+    uint64_t reserve = virtual_reserve_size ((void *) (HUGE_PAGE_SIZE - 1),
+    					     initial_size, min_size, flags);
+    if (reserve == UINT64_MAX) {
+    	return NULL;
+    }
+    // room for the header, and to move the heap to the boundary.
+    uint64_t length = HUGE_PAGE_SIZE + HUGE_HEADER_SIZE + reserve;
+    uint8_t *base = mmap (NULL, length, PROT_READ | PROT_WRITE,
+    			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+    	return NULL;
+    }
+
+    uintptr_t data = ((uintptr_t) base + HUGE_HEADER_SIZE + 1 +
+    		      HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1);
+    void *heapstart = (void *) (data - 1);
+    huge_advise ((void *) data, (uint64_t) 1 << initial_size, 0);
+    init_allocator_ex (heapstart, initial_size, min_size, flags);
+    struct huge_header *header = huge_header (heapstart);
+    header->base = base;
+    header->length = length;
+    header->min_size = min_size;
+    return heapstart;
+}
+
+/*
+This function takes in the heapstart of a heap made by
+virtual_huge_create, and size of the block, and allocates a block like
+virtual_malloc. Blocks of order VIRTUAL_HUGE_ORDER or more are taken
+from the bottom of the heap, and backed with huge pages; smaller ones
+are taken from the top, and stay on ordinary pages.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+size - size of the block to be allocated (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of block of given size in virtual heap.
+*/
+void * virtual_huge_malloc (void * heapstart, uint32_t size) {
+
+    int huge = size > HUGE_PAGE_SIZE / 2 ||
+    	       huge_header (heapstart)->min_size >= VIRTUAL_HUGE_ORDER;
+    uint64_t usable = 0;
+    void *ptr = virtual_malloc_ex (heapstart, size, huge ?
+    				   VIRTUAL_LONG_LIVED : VIRTUAL_SHORT_LIVED,
+    				   &usable);
+    if (ptr != NULL && huge) {
+    	huge_advise (ptr, usable, 1);
+    }
+    return ptr;
+}
+
+/*
+This function takes in the heapstart of a heap made by
+virtual_huge_create, and ptr of a block, and frees it like virtual_free.
+A block backed with huge pages goes back to ordinary pages, so the
+smaller blocks that may be split from it later are not.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+ptr - address of the block (void*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_huge_free (void * heapstart, void * ptr) {
+
+    uint64_t usable = virtual_usable_size (heapstart, ptr);
+    if (virtual_free (heapstart, ptr) != 0) {
+    	return 1;
+    }
+    if (usable >= HUGE_PAGE_SIZE) {
+    	huge_advise (ptr, usable, 0);
+    }
+    return 0;
+}
+
+/*
+This function takes in the heapstart of a heap made by
+virtual_huge_create, and unmaps it. The heap cannot be used afterwards.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_huge_destroy (void * heapstart) {
+    struct huge_header *header = huge_header (heapstart);
+    return munmap (header->base, header->length) != 0;
+}
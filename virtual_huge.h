@@ -0,0 +1,31 @@
+#ifndef VIRTUAL_HUGE_H
+#define VIRTUAL_HUGE_H
+
+#include <stdint.h>
+
+/*
+Heaps in anonymous memory mapped for transparent huge pages, for large
+buffers. virtual_huge_create maps the heap with its data region at a
+2 MiB boundary, so every block of order VIRTUAL_HUGE_ORDER (2 MiB) or
+more covers whole huge pages.
+
+virtual_huge_malloc asks the kernel for huge pages (MADV_HUGEPAGE) for
+those blocks only, and packs them at the bottom of the heap. Smaller
+blocks are packed at the top, on ordinary pages (MADV_NOHUGEPAGE), so
+their churn never splits or collapses a huge page. Blocks are freed with
+virtual_huge_free; the other calls of virtual_alloc.h work on the heap
+too, without the advice.
+*/
+
+#define VIRTUAL_HUGE_ORDER 21
+
+void * virtual_huge_create(uint8_t initial_size, uint8_t min_size,
+                           uint32_t flags);
+
+void * virtual_huge_malloc(void * heapstart, uint32_t size);
+
+int virtual_huge_free(void * heapstart, void * ptr);
+
+int virtual_huge_destroy(void * heapstart);
+
+#endif
@@ -0,0 +1,268 @@
+#include "virtual_persist.h"
+#include "virtual_alloc.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_HEADER_SIZE 64
+
+/*
+The file starts with this header, and the heap follows it, at
+FILE_HEADER_SIZE bytes from the start of the mapping. The mapping is
+page aligned, so the heap has the same layout wherever it is mapped.
+*/
+struct file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags; // the flags the heap was initialised with
+    uint64_t file_size;
+    uint8_t initial_size;
+    uint8_t min_size;
+};
+
+_Static_assert (sizeof (struct file_header) <= FILE_HEADER_SIZE,
+		"the file header does not fit");
+
+static inline struct file_header * file_header (void * heapstart) {
+    return (struct file_header *) ((uint8_t *) heapstart - FILE_HEADER_SIZE);
+}
+
+// the size of a file holding a heap with the given geometry.
+static uint64_t file_size (uint8_t initial_size, uint8_t min_size,
+			   uint32_t flags) {
+    // only the alignment of heapstart matters, and mappings start at
+    // page boundaries, like address 0.
+    uint64_t reserve = virtual_reserve_size ((void *) FILE_HEADER_SIZE,
+    					     initial_size, min_size, flags);
+    if (reserve == UINT64_MAX) {
+    	return 0;
+    }
+    return FILE_HEADER_SIZE + reserve;
+}
+
+/*
+This function takes in an open, empty file, and the arguments of
+init_allocator_ex, and grows the file to hold a new heap, and maps it.
+The file is zero filled, so the heap is VIRTUAL_ZEROED, and it holds all
+the heap will ever need, so it is VIRTUAL_RESERVED. The mapping stays
+after fd is closed.
+
+parameters:
+fd - the file, opened for reading and writing (int)
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+flags - VIRTUAL_ALIGNED, or 0 (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the heapstart of the new heap.
+*/
+void * virtual_create_fd (int fd, uint8_t initial_size, uint8_t min_size,
+			  uint32_t flags) {
+
+    flags |= VIRTUAL_ZEROED | VIRTUAL_RESERVED;
+    uint64_t size = file_size (initial_size, min_size, flags);
+    if (size == 0 || ftruncate (fd, size) != 0) {
+    	return NULL;
+    }
+    uint8_t *base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    			  fd, 0);
+    if (base == MAP_FAILED) {
+    	return NULL;
+    }
+
+    void *heapstart = base + FILE_HEADER_SIZE;
+    init_allocator_ex (heapstart, initial_size, min_size, flags);
+    struct file_header *header = file_header (heapstart);
+    header->version = VIRTUAL_FILE_VERSION;
+    header->flags = flags;
+    header->file_size = size;
+    header->initial_size = initial_size;
+    header->min_size = min_size;
+    // the magic goes last, so a file cut short is never attached.
+    header->magic = VIRTUAL_FILE_MAGIC;
+    return heapstart;
+}
+
+/*
+This function takes in the path of a file that does not exist yet, and
+the arguments of init_allocator_ex, and creates the file with a new heap
+in it, like virtual_create_fd.
+
+parameters:
+path - the file to be created (const char*)
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+flags - VIRTUAL_ALIGNED, or 0 (uint32_t)
+
+return: (void*)
+on failure - it returns NULL, also if the file exists.
+on success - it returns the heapstart of the new heap.
+*/
+void * virtual_create (const char * path, uint8_t initial_size,
+		       uint8_t min_size, uint32_t flags) {
+
+    int fd = open (path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+    	return NULL;
+    }
+    void *heapstart = virtual_create_fd (fd, initial_size, min_size, flags);
+    close (fd);
+    if (heapstart == NULL) {
+    	unlink (path);
+    }
+    return heapstart;
+}
+
+/*
+This function takes in an open file holding a heap made by
+virtual_create_fd, and maps the heap, as it was left. Only the header is
+checked, not our data structure, which another process may be changing;
+it is for callers that check the heap under a lock of their own. The
+mapping stays after fd is closed.
+
+parameters:
+fd - the file, opened for reading and writing (int)
+
+return: (void*)
+on failure - it returns NULL, if the file cannot be mapped, or its
+header is damaged.
+on success - it returns the heapstart of the heap.
+*/
+void * virtual_map_fd (int fd) {
+
+    struct file_header header;
+    struct stat st;
+    if (fstat (fd, &st) != 0 ||
+        pread (fd, &header, sizeof (header), 0) != sizeof (header) ||
+        header.magic != VIRTUAL_FILE_MAGIC ||
+        header.version != VIRTUAL_FILE_VERSION ||
+        header.file_size != (uint64_t) st.st_size ||
+        header.file_size != file_size (header.initial_size,
+        			       header.min_size, header.flags)) {
+    	return NULL;
+    }
+    uint8_t *base = mmap (NULL, header.file_size, PROT_READ | PROT_WRITE,
+    			  MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+    	return NULL;
+    }
+    return base + FILE_HEADER_SIZE;
+}
+
+/*
+This function takes in the heapstart of a heap mapped by virtual_map_fd,
+and checks that our data structure describes the heap of its header. The
+search hints are reset, as the process that left them may have died
+while it changed the heap.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (int)
+on failure - it returns 1, if our data structure is damaged.
+on success - it returns 0.
+*/
+int virtual_check_mapped (void * heapstart) {
+    struct virtual_stats stats;
+    if (virtual_check (heapstart) != 0) {
+    	return 1;
+    }
+    virtual_reset_hints (heapstart);
+    virtual_stats (heapstart, &stats);
+    return stats.heap_size !=
+    	   (uint64_t) 1 << file_header (heapstart)->initial_size;
+}
+
+/*
+This function takes in an open file holding a heap made by
+virtual_create_fd, and maps the heap, as it was left. Nothing is
+initialised: the header and our data structure are only checked, so
+this takes time proportional to the number of blocks, not to the size
+of the heap. The mapping stays after fd is closed.
+
+parameters:
+fd - the file, opened for reading and writing (int)
+
+return: (void*)
+on failure - it returns NULL, if the file cannot be mapped, or its
+header or our data structure is damaged.
+on success - it returns the heapstart of the heap.
+*/
+void * virtual_attach_fd (int fd) {
+
+    void *heapstart = virtual_map_fd (fd);
+    if (heapstart == NULL) {
+    	return NULL;
+    }
+    if (virtual_check_mapped (heapstart) != 0) {
+    	struct file_header *header = file_header (heapstart);
+    	munmap (header, header->file_size);
+    	return NULL;
+    }
+    virtual_set_mover (heapstart, NULL, NULL);
+    return heapstart;
+}
+
+/*
+This function takes in the path of a file made by virtual_create, and
+maps its heap, like virtual_attach_fd.
+
+parameters:
+path - the file holding the heap (const char*)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the heapstart of the heap.
+*/
+void * virtual_attach (const char * path) {
+    int fd = open (path, O_RDWR);
+    if (fd < 0) {
+    	return NULL;
+    }
+    void *heapstart = virtual_attach_fd (fd);
+    close (fd);
+    return heapstart;
+}
+
+/*
+This function takes in the heapstart of a heap made by virtual_create or
+virtual_attach, or their fd variants, and writes it back to its file.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_sync (void * heapstart) {
+    struct file_header *header = file_header (heapstart);
+    return msync (header, header->file_size, MS_SYNC) != 0;
+}
+
+/*
+This function takes in the heapstart of a heap made by virtual_create or
+virtual_attach, or their fd variants, writes it back to its file, and
+unmaps it. The heap
+cannot be used afterwards, until it is attached again.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+
+return: (int)
+on failure - it returns 1, if the heap could not be written back. It
+is unmapped anyway.
+on success - it returns 0.
+*/
+int virtual_detach (void * heapstart) {
+    struct file_header *header = file_header (heapstart);
+    uint64_t size = header->file_size;
+    int result = virtual_sync (heapstart);
+    if (munmap (header, size) != 0) {
+    	result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,45 @@
+#ifndef VIRTUAL_PERSIST_H
+#define VIRTUAL_PERSIST_H
+
+#include <stdint.h>
+
+/*
+Heaps kept in a memory mapped file, so their contents outlive the
+process. virtual_create makes a new file, big enough for the heap and
+the largest our data structure can grow, and initialises the heap in it.
+virtual_attach maps an existing file again, after checking its header
+and our data structure, without initialising anything.
+
+The file may be mapped at a different address every time. The allocator
+only stores offsets in the heap, and so should its users: offsets from
+virtual_data stay valid, pointers into the heap do not. Movers set with
+virtual_set_mover belong to a process, and are cleared on attach.
+
+The fd variants work on any file that can be mapped, such as POSIX
+shared memory objects. virtual_map_fd maps without checking our data
+structure, for heaps other processes are using; virtual_check_mapped
+checks it once their lock is held.
+*/
+
+#define VIRTUAL_FILE_MAGIC 0x5041454854524956ull // "VIRTHEAP"
+#define VIRTUAL_FILE_VERSION 4
+
+void * virtual_create(const char * path, uint8_t initial_size, uint8_t min_size,
+                      uint32_t flags);
+
+void * virtual_attach(const char * path);
+
+void * virtual_create_fd(int fd, uint8_t initial_size, uint8_t min_size,
+                         uint32_t flags);
+
+void * virtual_attach_fd(int fd);
+
+void * virtual_map_fd(int fd);
+
+int virtual_check_mapped(void * heapstart);
+
+int virtual_sync(void * heapstart);
+
+int virtual_detach(void * heapstart);
+
+#endif
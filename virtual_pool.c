@@ -0,0 +1,289 @@
+#include "virtual_pool.h"
+#include "virtual_alloc.h"
+#include <stddef.h>
+
+#define POOL_MAGIC 0x504f4f4c
+#define POOL_MIN_SLAB 4096
+#define POOL_MIN_OBJECTS 32
+#define HEADER_ALIGN _Alignof (max_align_t)
+
+/*
+Every slab is one buddy block of slab_size bytes. A buddy block of size
+2^j always starts at a multiple of 2^j from the data region, so the slab
+of an object is found by rounding its offset down to slab_size. The slab
+header starts at the first aligned address of the block, and is followed
+by the objects.
+
+Objects that were never handed out are not on the free list; they are
+carved from bump, so a new slab is ready without touching its objects.
+*/
+struct pool_slab {
+    uint32_t magic;
+    uint32_t used; // objects handed out
+    struct pool *pool;
+    struct pool_slab *prev;
+    struct pool_slab *next;
+    void *free; // free list of objects that were handed out before
+    uint8_t *bump; // next object never handed out
+    uint8_t *end; // end of the last object
+};
+
+/*
+Slabs with free objects are on the partial list, the others on the full
+list. One slab whose objects are all free is kept as spare, so a pool
+that keeps emptying and refilling one slab does not go back to the heap.
+*/
+struct pool {
+    void *heapstart;
+    void *block; // the block the pool lives in
+    uint8_t *data; // the data region of the heap
+    uint64_t heap_size;
+    uint32_t obj_size;
+    uint32_t align;
+    uint32_t slab_size;
+    struct pool_slab *partial;
+    struct pool_slab *full;
+    struct pool_slab *spare;
+};
+
+static inline uint8_t * align_up (uint8_t * ptr, uint32_t align) {
+    return (uint8_t *) (((uintptr_t) ptr + align - 1) &
+    			~(uintptr_t) (align - 1));
+}
+
+// the block of the slab holding ptr, which may be any address in it.
+static inline uint8_t * slab_block (struct pool * pool, void * ptr) {
+    uint64_t offset = (uint8_t *) ptr - pool->data;
+    return pool->data + (offset & ~(uint64_t) (pool->slab_size - 1));
+}
+
+static void slab_unlink (struct pool_slab ** list, struct pool_slab * slab) {
+    if (slab->prev != NULL) {
+    	slab->prev->next = slab->next;
+    } else {
+    	*list = slab->next;
+    }
+    if (slab->next != NULL) {
+    	slab->next->prev = slab->prev;
+    }
+}
+
+static void slab_push (struct pool_slab ** list, struct pool_slab * slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) {
+    	(*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+/*
+This function takes in a pool, and takes a new slab from the heap, with
+all of its objects free.
+
+parameters:
+pool - the pool (struct pool*)
+
+return: (struct pool_slab*)
+on failure - it returns NULL.
+on success - it returns the new slab.
+*/
+static struct pool_slab * slab_new (struct pool * pool) {
+
+    uint8_t *block = virtual_malloc (pool->heapstart, pool->slab_size);
+    if (block == NULL) {
+    	return NULL;
+    }
+    struct pool_slab *slab = (struct pool_slab *) align_up (block,
+    							      HEADER_ALIGN);
+    uint8_t *first = align_up ((uint8_t *) (slab + 1), pool->align);
+    uint64_t count = (block + pool->slab_size - first) / pool->obj_size;
+    slab->magic = POOL_MAGIC;
+    slab->used = 0;
+    slab->pool = pool;
+    slab->free = NULL;
+    slab->bump = first;
+    slab->end = first + count * pool->obj_size;
+    return slab;
+}
+
+/*
+This function takes in the heapstart, the size of the objects and their
+alignment, and creates an empty pool. Slabs are the smallest blocks of
+at least POOL_MIN_SLAB bytes that hold POOL_MIN_OBJECTS objects.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+obj_size - size of every object (uint32_t)
+align - alignment of every object, a power of two (uint32_t)
+
+return: (struct pool*)
+on failure - it returns NULL, also if obj_size is 0 or align is not a
+power of two.
+on success - it returns the new pool.
+*/
+struct pool * pool_create (void * heapstart, uint32_t obj_size,
+			   uint32_t align) {
+
+    if (obj_size == 0 || align == 0 || (align & (align - 1)) != 0) {
+    	return NULL;
+    }
+    // free objects hold the next pointer of the free list.
+    if (align < _Alignof (void *)) {
+    	align = _Alignof (void *);
+    }
+    uint64_t size = (obj_size < sizeof (void *)) ? sizeof (void *) : obj_size;
+    size = (size + align - 1) & ~(uint64_t) (align - 1);
+    uint64_t need = sizeof (struct pool_slab) + HEADER_ALIGN + align +
+    		    POOL_MIN_OBJECTS * size;
+    uint64_t slab_size = POOL_MIN_SLAB;
+    while (slab_size < need) {
+    	slab_size *= 2;
+    }
+    if (slab_size > UINT32_MAX / 2 + 1) {
+    	return NULL;
+    }
+
+    uint8_t *block = virtual_malloc (heapstart,
+    				     sizeof (struct pool) + HEADER_ALIGN);
+    if (block == NULL) {
+    	return NULL;
+    }
+    struct pool *pool = (struct pool *) align_up (block, HEADER_ALIGN);
+    struct virtual_stats stats;
+    virtual_stats (heapstart, &stats);
+    pool->heapstart = heapstart;
+    pool->block = block;
+    pool->data = virtual_data (heapstart);
+    pool->heap_size = stats.heap_size;
+    pool->obj_size = size;
+    pool->align = align;
+    pool->slab_size = slab_size;
+    pool->partial = NULL;
+    pool->full = NULL;
+    pool->spare = NULL;
+    return pool;
+}
+
+/*
+This function takes in a pool, and hands out one object, from the first
+slab with free objects. A slab is taken from the heap only when every
+slab is full and there is no spare one.
+
+parameters:
+pool - the pool (struct pool*)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of the object.
+*/
+void * pool_get (struct pool * pool) {
+
+    struct pool_slab *slab = pool->partial;
+    if (slab == NULL) {
+    	slab = pool->spare;
+    	pool->spare = NULL;
+    	if (slab == NULL) {
+    		slab = slab_new (pool);
+    	}
+    	if (slab == NULL) {
+    		return NULL;
+    	}
+    	slab_push (&pool->partial, slab);
+    }
+
+    void *ptr = slab->free;
+    if (ptr != NULL) {
+    	slab->free = *(void **) ptr;
+    } else {
+    	ptr = slab->bump;
+    	slab->bump += pool->obj_size;
+    }
+    slab->used += 1;
+    if (slab->free == NULL && slab->bump == slab->end) {
+    	slab_unlink (&pool->partial, slab);
+    	slab_push (&pool->full, slab);
+    }
+    return ptr;
+}
+
+/*
+This function takes in a pool, and an object of it, and puts the object
+back on the free list of its slab. A slab with no objects in use becomes
+the spare slab, or is given back to the heap if there already is one.
+
+parameters:
+pool - the pool (struct pool*)
+ptr - an object handed out by pool_get (void*)
+
+return: (int)
+on failure - it returns 1, if ptr is not an object of this pool.
+on success - it returns 0.
+*/
+int pool_put (struct pool * pool, void * ptr) {
+
+    uint8_t *p = ptr;
+    if (p == NULL || p < pool->data || p >= pool->data + pool->heap_size) {
+    	return 1;
+    }
+    struct pool_slab *slab = (struct pool_slab *)
+    			     align_up (slab_block (pool, p), HEADER_ALIGN);
+    uint8_t *first = align_up ((uint8_t *) (slab + 1), pool->align);
+    if (slab->magic != POOL_MAGIC || slab->pool != pool || p < first ||
+        p >= slab->bump || (p - first) % pool->obj_size != 0 ||
+        slab->used == 0) {
+    	return 1;
+    }
+
+    int was_full = (slab->free == NULL && slab->bump == slab->end);
+    *(void **) p = slab->free;
+    slab->free = p;
+    slab->used -= 1;
+    if (was_full) {
+    	slab_unlink (&pool->full, slab);
+    	slab_push (&pool->partial, slab);
+    }
+
+    if (slab->used == 0) {
+    	slab_unlink (&pool->partial, slab);
+    	if (pool->spare == NULL) {
+    		// carving from the start again keeps the spare slab dense.
+    		slab->free = NULL;
+    		slab->bump = first;
+    		pool->spare = slab;
+    	} else {
+    		slab->magic = 0;
+    		virtual_free (pool->heapstart, slab_block (pool, slab));
+    	}
+    }
+    return 0;
+}
+
+static void slab_free_all (struct pool * pool, struct pool_slab * slab) {
+    while (slab != NULL) {
+    	struct pool_slab *next = slab->next;
+    	slab->magic = 0;
+    	virtual_free (pool->heapstart, slab_block (pool, slab));
+    	slab = next;
+    }
+}
+
+/*
+This function takes in a pool, and gives all of its slabs back to the
+heap, including slabs with objects in use. The pool cannot be used
+afterwards.
+
+parameters:
+pool - the pool (struct pool*)
+
+return: void return type
+*/
+void pool_destroy (struct pool * pool) {
+    slab_free_all (pool, pool->partial);
+    slab_free_all (pool, pool->full);
+    if (pool->spare != NULL) {
+    	pool->spare->next = NULL;
+    	slab_free_all (pool, pool->spare);
+    }
+    virtual_free (pool->heapstart, pool->block);
+}
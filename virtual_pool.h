@@ -0,0 +1,25 @@
+#ifndef VIRTUAL_POOL_H
+#define VIRTUAL_POOL_H
+
+#include <stdint.h>
+
+/*
+Fixed size object pools on top of the buddy allocator. A pool carves
+objects of one size out of slabs, large buddy blocks taken from
+virtual_malloc, and keeps the free objects of every slab in an intrusive
+free list. Objects are not rounded up to a power of two, and getting or
+putting one never searches the buddy metadata. Slabs are taken from the
+heap when all are full, and given back when all their objects are free.
+*/
+
+struct pool;
+
+struct pool * pool_create(void * heapstart, uint32_t obj_size, uint32_t align);
+
+void * pool_get(struct pool * pool);
+
+int pool_put(struct pool * pool, void * ptr);
+
+void pool_destroy(struct pool * pool);
+
+#endif
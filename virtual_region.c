@@ -0,0 +1,178 @@
+#include "virtual_region.h"
+#include "virtual_alloc.h"
+#include <stddef.h>
+
+// every object is aligned like malloc would align it.
+#define REGION_ALIGN _Alignof (max_align_t)
+
+/*
+Every chunk is one buddy block. Blocks of the packed layout are not
+aligned, so the chunk header starts at the first aligned address in the
+block. The region itself lives right after the header of its first
+chunk.
+*/
+struct region_chunk {
+    struct region_chunk *next;
+    void *block; // the block returned by virtual_malloc
+    uint8_t *end; // end of the block
+};
+
+struct region {
+    void *heapstart;
+    uint32_t chunk_size;
+    struct region_chunk *first;
+    struct region_chunk *current;
+    uint8_t *top; // next free byte in current
+    uint8_t *start; // first byte of the first chunk after the region
+};
+
+static inline uint8_t * align_up (uint8_t * ptr) {
+    return (uint8_t *) (((uintptr_t) ptr + REGION_ALIGN - 1) &
+    			~(uintptr_t) (REGION_ALIGN - 1));
+}
+
+/*
+This function takes in the heapstart, and the number of bytes a chunk
+has to hold after its header, and allocates a new chunk.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+size - number of bytes needed after the header (uint64_t)
+
+return: (struct region_chunk*)
+on failure - it returns NULL.
+on success - it returns the new chunk.
+*/
+static struct region_chunk * chunk_new (void * heapstart, uint64_t size) {
+
+    uint64_t total = size + sizeof (struct region_chunk) + REGION_ALIGN;
+    if (total > UINT32_MAX) {
+    	return NULL;
+    }
+    uint8_t *block = virtual_malloc (heapstart, total);
+    if (block == NULL) {
+    	return NULL;
+    }
+    struct region_chunk *chunk = (struct region_chunk *) align_up (block);
+    chunk->next = NULL;
+    chunk->block = block;
+    chunk->end = block + virtual_usable_size (heapstart, block);
+    return chunk;
+}
+
+/*
+This function takes in the heapstart, and the size of the chunks, and
+creates an empty region. Chunks are blocks of at least chunk_size bytes,
+objects larger than that get a chunk of their own.
+
+parameters:
+heapstart - the address where the heap starts (void*)
+chunk_size - number of bytes of each chunk (uint32_t)
+
+return: (struct region*)
+on failure - it returns NULL.
+on success - it returns the new region.
+*/
+struct region * region_create (void * heapstart, uint32_t chunk_size) {
+
+    struct region_chunk *chunk = chunk_new (heapstart,
+    					    (uint64_t) chunk_size +
+    					    sizeof (struct region));
+    if (chunk == NULL) {
+    	return NULL;
+    }
+    struct region *region = (struct region *) align_up ((uint8_t *) (chunk + 1));
+    region->heapstart = heapstart;
+    region->chunk_size = chunk_size;
+    region->first = chunk;
+    region->current = chunk;
+    region->start = (uint8_t *) (region + 1);
+    region->top = region->start;
+    return region;
+}
+
+/*
+This function takes in a region, and the size of an object, and bump
+allocates the object in the current chunk. When it does not fit, the
+next chunk kept by region_reset is tried, and otherwise a new chunk is
+put after the current one.
+
+parameters:
+region - the region (struct region*)
+size - size of the object (uint32_t)
+
+return: (void*)
+on failure - it returns NULL, also if size is 0.
+on success - it returns the address of the object.
+*/
+void * region_alloc (struct region * region, uint32_t size) {
+
+    if (size == 0) {
+    	return NULL;
+    }
+    uint8_t *ptr = align_up (region->top);
+    if (ptr + size <= region->current->end) {
+    	region->top = ptr + size;
+    	return ptr;
+    }
+
+    struct region_chunk *next = region->current->next;
+    if (next != NULL) {
+    	ptr = align_up ((uint8_t *) (next + 1));
+    	if (ptr + size <= next->end) {
+    		region->current = next;
+    		region->top = ptr + size;
+    		return ptr;
+    	}
+    }
+
+    uint64_t need = (size > region->chunk_size) ? size : region->chunk_size;
+    struct region_chunk *chunk = chunk_new (region->heapstart, need);
+    if (chunk == NULL) {
+    	return NULL;
+    }
+    chunk->next = next;
+    region->current->next = chunk;
+    region->current = chunk;
+    ptr = align_up ((uint8_t *) (chunk + 1));
+    region->top = ptr + size;
+    return ptr;
+}
+
+/*
+This function takes in a region, and frees all of its objects at once.
+The chunks are kept and reused by the following allocations, so this
+takes constant time.
+
+parameters:
+region - the region (struct region*)
+
+return: void return type
+*/
+void region_reset (struct region * region) {
+    region->current = region->first;
+    region->top = region->start;
+}
+
+/*
+This function takes in a region, and gives all of its chunks back to the
+heap. The region cannot be used afterwards.
+
+parameters:
+region - the region (struct region*)
+
+return: void return type
+*/
+void region_destroy (struct region * region) {
+
+    void *heapstart = region->heapstart;
+    struct region_chunk *first = region->first;
+    struct region_chunk *chunk = first->next;
+    while (chunk != NULL) {
+    	struct region_chunk *next = chunk->next;
+    	virtual_free (heapstart, chunk->block);
+    	chunk = next;
+    }
+    // the region lives in the first chunk.
+    virtual_free (heapstart, first->block);
+}
@@ -0,0 +1,24 @@
+#ifndef VIRTUAL_REGION_H
+#define VIRTUAL_REGION_H
+
+#include <stdint.h>
+
+/*
+Region allocator on top of the buddy allocator. A region takes chunks
+from virtual_malloc and bump allocates objects inside them. Objects are
+never freed one by one: region_reset makes all of them free at once in
+constant time, keeping the chunks for the next round, and region_destroy
+gives every chunk back to the heap.
+*/
+
+struct region;
+
+struct region * region_create(void * heapstart, uint32_t chunk_size);
+
+void * region_alloc(struct region * region, uint32_t size);
+
+void region_reset(struct region * region);
+
+void region_destroy(struct region * region);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef VIRTUAL_RESOURCE_HPP
+#define VIRTUAL_RESOURCE_HPP
+
+#include "virtual_alloc.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+
+/*
+A std::pmr::memory_resource over one buddy heap, so pmr containers can
+live on a heap of their own. Allocations go through
+virtual_aligned_alloc, and deallocations through virtual_free_sized,
+which checks the block against the size the container passes back.
+
+Alignments up to alignof(std::max_align_t) need the data region to be
+aligned, which only heaps initialised with VIRTUAL_ALIGNED guarantee, so
+the constructor throws std::invalid_argument for other heaps. The
+resource does not own the heap; destroying it frees nothing.
+*/
+
+namespace virtual_alloc {
+
+class buddy_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit buddy_memory_resource (void * heapstart)
+        : heapstart_ (heapstart) {
+    	if (!virtual_is_aligned (heapstart)) {
+    		throw std::invalid_argument (
+    			"buddy_memory_resource needs a VIRTUAL_ALIGNED heap");
+    	}
+    }
+
+    void * heapstart () const noexcept {
+    	return heapstart_;
+    }
+
+private:
+    // the size the block was allocated with, as virtual_aligned_alloc
+    // rounds it up to the alignment.
+    static std::uint32_t block_size (std::size_t bytes,
+    				     std::size_t alignment) noexcept {
+    	return static_cast<std::uint32_t> (bytes < alignment ?
+    					   alignment : bytes);
+    }
+
+    void * do_allocate (std::size_t bytes, std::size_t alignment) override {
+    	if (bytes > UINT32_MAX || alignment > UINT32_MAX) {
+    		throw std::bad_alloc ();
+    	}
+    	void *ptr = virtual_aligned_alloc (heapstart_,
+    					   static_cast<std::uint32_t> (alignment),
+    					   block_size (bytes, alignment));
+    	if (ptr == nullptr) {
+    		throw std::bad_alloc ();
+    	}
+    	return ptr;
+    }
+
+    void do_deallocate (void * ptr, std::size_t bytes,
+    			std::size_t alignment) override {
+    	virtual_free_sized (heapstart_, ptr, block_size (bytes, alignment));
+    }
+
+    bool do_is_equal (const std::pmr::memory_resource & other)
+    				const noexcept override {
+    	const buddy_memory_resource *buddy =
+    		dynamic_cast<const buddy_memory_resource *> (&other);
+    	return buddy != nullptr && buddy->heapstart_ == heapstart_;
+    }
+
+    void *heapstart_;
+};
+
+}
+
+#endif
@@ -1,3 +1,6 @@
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C"
+#endif
 void * virtual_sbrk(int32_t increment);
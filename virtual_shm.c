@@ -0,0 +1,260 @@
+#include "virtual_shm.h"
+#include "virtual_alloc.h"
+#include "virtual_persist.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define LOCK_ALIGN _Alignof (max_align_t)
+#define LOCK_READY 0x4c4f434b
+
+/*
+The lock lives in the first block of the heap, allocated right after
+the heap is created, so it is at the start of the data region in every
+process. ready is set last, so a process attaching while the heap is
+being created never uses a mutex that is not initialised yet.
+*/
+struct shm_lock {
+    pthread_mutex_t mutex;
+    uint32_t ready;
+};
+
+static inline uint8_t * align_up (uint8_t * ptr) {
+    return (uint8_t *) (((uintptr_t) ptr + LOCK_ALIGN - 1) &
+    			~(uintptr_t) (LOCK_ALIGN - 1));
+}
+
+static inline struct shm_lock * shm_lock (void * heapstart) {
+    return (struct shm_lock *) align_up (virtual_data (heapstart));
+}
+
+/*
+This function takes in the name of a shared memory object that does not
+exist yet, and the arguments of init_allocator_ex, and creates the
+object with a new heap in it.
+
+parameters:
+name - name of the shared memory object, starting with / (const char*)
+initial_size - the initial size of virtual heap (uint8_t)
+min_size - the minimum size of virtual heap (uint8_t)
+flags - VIRTUAL_ALIGNED, or 0 (uint32_t)
+
+return: (void*)
+on failure - it returns NULL, also if the object exists.
+on success - it returns the heapstart of the new heap.
+*/
+void * virtual_shm_create (const char * name, uint8_t initial_size,
+			   uint8_t min_size, uint32_t flags) {
+
+    int fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+    	return NULL;
+    }
+    void *heapstart = virtual_create_fd (fd, initial_size, min_size, flags);
+    close (fd);
+    if (heapstart == NULL) {
+    	shm_unlink (name);
+    	return NULL;
+    }
+    uint8_t *block = virtual_malloc (heapstart,
+    				     sizeof (struct shm_lock) + LOCK_ALIGN);
+    if (block != virtual_data (heapstart)) {
+    	virtual_detach (heapstart);
+    	shm_unlink (name);
+    	return NULL;
+    }
+
+    // robust, so a process dying while it holds the lock does not
+    // block the others forever.
+    struct shm_lock *lock = shm_lock (heapstart);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+    int error = pthread_mutex_init (&lock->mutex, &attr);
+    pthread_mutexattr_destroy (&attr);
+    if (error != 0) {
+    	virtual_detach (heapstart);
+    	shm_unlink (name);
+    	return NULL;
+    }
+    __atomic_store_n (&lock->ready, LOCK_READY, __ATOMIC_RELEASE);
+    return heapstart;
+}
+
+/*
+This function takes in the name of a shared memory object made by
+virtual_shm_create, and maps its heap into this process. The heap is
+checked holding the lock, as the other processes keep using it.
+
+parameters:
+name - name of the shared memory object (const char*)
+
+return: (void*)
+on failure - it returns NULL, if the object cannot be mapped, or is not
+a shared heap, or is still being created, or is damaged.
+on success - it returns the heapstart of the heap in this process.
+*/
+void * virtual_shm_attach (const char * name) {
+
+    int fd = shm_open (name, O_RDWR, 0);
+    if (fd < 0) {
+    	return NULL;
+    }
+    void *heapstart = virtual_map_fd (fd);
+    close (fd);
+    if (heapstart == NULL) {
+    	return NULL;
+    }
+    struct shm_lock *lock = shm_lock (heapstart);
+    if (__atomic_load_n (&lock->ready, __ATOMIC_ACQUIRE) != LOCK_READY ||
+        virtual_shm_lock (heapstart) != 0) {
+    	virtual_detach (heapstart);
+    	return NULL;
+    }
+    int damaged = virtual_check_mapped (heapstart);
+    virtual_shm_unlock (heapstart);
+    if (damaged) {
+    	virtual_detach (heapstart);
+    	return NULL;
+    }
+    return heapstart;
+}
+
+/*
+This function takes in the heapstart of a shared heap, and unmaps it
+from this process. The heap stays for the other processes.
+
+parameters:
+heapstart - the address where the heap starts in this process (void*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_shm_detach (void * heapstart) {
+    return virtual_detach (heapstart);
+}
+
+/*
+This function takes in the name of a shared heap, and removes it. It is
+freed once every process has detached it.
+
+parameters:
+name - name of the shared memory object (const char*)
+
+return: (int)
+on failure - it returns 1.
+on success - it returns 0.
+*/
+int virtual_shm_unlink (const char * name) {
+    return shm_unlink (name) != 0;
+}
+
+/*
+This function takes in the heapstart of a shared heap, and waits until
+this process holds its lock. If a process died holding the lock, the
+heap is checked with virtual_check, and its search hints are reset,
+before it is used again.
+
+parameters:
+heapstart - the address where the heap starts in this process (void*)
+
+return: (int)
+on failure - it returns 1, if the heap was left damaged by a process
+that died holding the lock. The heap cannot be used any more.
+on success - it returns 0.
+*/
+int virtual_shm_lock (void * heapstart) {
+
+    struct shm_lock *lock = shm_lock (heapstart);
+    int error = pthread_mutex_lock (&lock->mutex);
+    if (error == EOWNERDEAD) {
+    	if (virtual_check (heapstart) != 0) {
+    		// never made consistent, so every later lock fails.
+    		pthread_mutex_unlock (&lock->mutex);
+    		return 1;
+    	}
+    	virtual_reset_hints (heapstart);
+    	pthread_mutex_consistent (&lock->mutex);
+    	return 0;
+    }
+    return error != 0;
+}
+
+/*
+This function takes in the heapstart of a shared heap, and releases the
+lock taken by virtual_shm_lock.
+
+parameters:
+heapstart - the address where the heap starts in this process (void*)
+
+return: void return type
+*/
+void virtual_shm_unlock (void * heapstart) {
+    pthread_mutex_unlock (&shm_lock (heapstart)->mutex);
+}
+
+/*
+This function takes in the heapstart of a shared heap, and the size of
+a block, and allocates it like virtual_malloc, holding the lock.
+
+parameters:
+heapstart - the address where the heap starts in this process (void*)
+size - size of the block to be allocated (uint32_t)
+
+return: (void*)
+on failure - it returns NULL.
+on success - it returns the address of the block in this process.
+*/
+void * virtual_shm_malloc (void * heapstart, uint32_t size) {
+    if (virtual_shm_lock (heapstart) != 0) {
+    	return NULL;
+    }
+    void *ptr = virtual_malloc (heapstart, size);
+    virtual_shm_unlock (heapstart);
+    return ptr;
+}
+
+/*
+This function takes in the heapstart of a shared heap, and a block
+allocated by any of the processes, and frees it like virtual_free,
+holding the lock.
+
+parameters:
+heapstart - the address where the heap starts in this process (void*)
+ptr - the address of the block in this process (void*)
+
+return: (int)
+on failure - it returns 1, also for the block holding the lock.
+on success - it returns 0.
+*/
+int virtual_shm_free (void * heapstart, void * ptr) {
+    if (ptr == virtual_data (heapstart) || virtual_shm_lock (heapstart) != 0) {
+    	return 1;
+    }
+    int result = virtual_free (heapstart, ptr);
+    virtual_shm_unlock (heapstart);
+    return result;
+}
+
+/*
+This function takes in the heapstart of a shared heap, and the address
+of a block in this process, and returns the offset to pass to other
+processes.
+*/
+uint64_t virtual_shm_offset (void * heapstart, void * ptr) {
+    return (uint8_t *) ptr - (uint8_t *) virtual_data (heapstart);
+}
+
+/*
+This function takes in the heapstart of a shared heap, and an offset
+from virtual_shm_offset, and returns the address of the block in this
+process.
+*/
+void * virtual_shm_ptr (void * heapstart, uint64_t offset) {
+    return (uint8_t *) virtual_data (heapstart) + offset;
+}
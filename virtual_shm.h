@@ -0,0 +1,42 @@
+#ifndef VIRTUAL_SHM_H
+#define VIRTUAL_SHM_H
+
+#include <stdint.h>
+
+/*
+Heaps in POSIX shared memory, shared by several processes. One process
+creates the heap with virtual_shm_create, others map it with
+virtual_shm_attach, and any of them can allocate a block, pass its
+offset to another process, which reads and frees it, without copying.
+
+The heap is a file heap (virtual_persist.h) on a shared memory object,
+with a process shared mutex in its first block. virtual_shm_malloc and
+virtual_shm_free take the mutex; other calls on the heap go between
+virtual_shm_lock and virtual_shm_unlock. The heap is mapped at a
+different address in every process, so only offsets are passed around.
+Movers hold addresses of one process, so virtual_set_mover and
+virtual_defrag_step are not for shared heaps.
+*/
+
+void * virtual_shm_create(const char * name, uint8_t initial_size,
+                          uint8_t min_size, uint32_t flags);
+
+void * virtual_shm_attach(const char * name);
+
+int virtual_shm_detach(void * heapstart);
+
+int virtual_shm_unlink(const char * name);
+
+int virtual_shm_lock(void * heapstart);
+
+void virtual_shm_unlock(void * heapstart);
+
+void * virtual_shm_malloc(void * heapstart, uint32_t size);
+
+int virtual_shm_free(void * heapstart, void * ptr);
+
+uint64_t virtual_shm_offset(void * heapstart, void * ptr);
+
+void * virtual_shm_ptr(void * heapstart, uint64_t offset);
+
+#endif
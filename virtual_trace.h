@@ -0,0 +1,74 @@
+#ifndef VIRTUAL_TRACE_H
+#define VIRTUAL_TRACE_H
+
+#include <stdint.h>
+
+/*
+Binary allocation trace format, written by virtual_trace_start and read
+by the replay driver.
+
+A trace starts with an 8 byte header:
+  bytes 0-3 - magic "VATR"
+  bytes 4-5 - format version (little endian)
+  byte  6   - initial_size of the recorded heap
+  byte  7   - min_size of the recorded heap
+
+followed by fixed size 21 byte records, one per public call:
+  byte  0     - operation (TRACE_MALLOC, TRACE_FREE, TRACE_REALLOC)
+  bytes 1-4   - requested size (0 for free)
+  bytes 5-12  - offset of the ptr argument from heapstart (0 for NULL,
+                unused for malloc)
+  bytes 13-20 - offset of the returned block from heapstart (0 for NULL),
+                or the return code for free
+
+All integers are little endian. Offsets are relative to heapstart, so a
+trace does not depend on where the recorded heap was mapped.
+*/
+
+#define TRACE_MAGIC "VATR"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 8
+#define TRACE_RECORD_SIZE 21
+
+#define TRACE_MALLOC 'M'
+#define TRACE_FREE 'F'
+#define TRACE_REALLOC 'R'
+
+struct trace_record {
+    uint8_t op;
+    uint32_t size;
+    uint64_t ptr;
+    uint64_t result;
+};
+
+static inline void trace_put (uint8_t *out, uint64_t value, int bytes) {
+    int i = 0;
+    for (i = 0; i < bytes; i ++) {
+    	out [i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+static inline uint64_t trace_get (const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    int i = 0;
+    for (i = 0; i < bytes; i ++) {
+    	value |= (uint64_t) in [i] << (8 * i);
+    }
+    return value;
+}
+
+static inline void trace_encode (uint8_t *out, const struct trace_record *rec) {
+    out [0] = rec->op;
+    trace_put (out + 1, rec->size, 4);
+    trace_put (out + 5, rec->ptr, 8);
+    trace_put (out + 13, rec->result, 8);
+}
+
+static inline void trace_decode (const uint8_t *in, struct trace_record *rec) {
+    rec->op = in [0];
+    rec->size = (uint32_t) trace_get (in + 1, 4);
+    rec->ptr = trace_get (in + 5, 8);
+    rec->result = trace_get (in + 13, 8);
+}
+
+#endif